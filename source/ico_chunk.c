@@ -10,6 +10,9 @@ void init_chunk(CodeChunk *chunk) {
     chunk->chunk = NULL;
     chunk->line_nums = NULL;
     init_value_array(&chunk->const_pool);
+    chunk->cache_count = 0;
+    chunk->cache_capacity = 0;
+    chunk->caches = NULL;
 }
 
 void append_chunk(CodeChunk* chunk, uint8_t byte, int line_num) {
@@ -37,6 +40,9 @@ void free_chunk(CodeChunk* chunk) {
     // Also free the constant pool
     free_value_array(&chunk->const_pool);
 
+    // And the inline caches
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cache_capacity);
+
     // Use init_chunk to reset the fields
     init_chunk(chunk);
 }
@@ -47,3 +53,18 @@ int add_constant(CodeChunk* chunk, IcoValue val) {
     pop();
     return chunk->const_pool.size - 1;
 }
+
+int add_inline_cache(CodeChunk* chunk, int offset) {
+    if (chunk->cache_capacity < chunk->cache_count + 1) {
+        int old_cap = chunk->cache_capacity;
+        chunk->cache_capacity = GROW_CAPACITY(old_cap);
+        chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, old_cap, chunk->cache_capacity);
+    }
+
+    // An empty cache has a NULL shape and entries array, which are never a hit
+    chunk->caches[chunk->cache_count] = (InlineCache){
+        .shape = NULL, .entries = NULL, .slot = 0,
+        .hits = 0, .misses = 0, .offset = offset
+    };
+    return chunk->cache_count++;
+}
@@ -3,6 +3,8 @@
 
 #include "ico_common.h"
 #include "ico_value.h"
+#include "ico_shape.h"
+#include "ico_table.h"
 
 // Enum for types of opcode
 typedef enum {
@@ -34,9 +36,9 @@ typedef enum {
     OP_POP,         // [pop]: Pop the VM stack
 
     // For global and local variables
-    OP_DEFINE_GLOBAL,
-    OP_GET_GLOBAL,
-    OP_SET_GLOBAL,
+    OP_DEFINE_GLOBAL,   // [define][slot hi][slot lo]: 2-byte global slot index
+    OP_GET_GLOBAL,      // [get][slot hi][slot lo]
+    OP_SET_GLOBAL,      // [set][slot hi][slot lo]
     OP_GET_LOCAL,
     OP_SET_LOCAL,
 
@@ -47,6 +49,13 @@ typedef enum {
 
     // Function-related instructions
     OP_CALL,            // [op_call][arg_count]: Function call
+    OP_CALL_0,          // [op_call_n][arg_count]: Call with 0-3 args. The arg count is
+    OP_CALL_1,          // implied by the opcode, the operand is only kept so that
+    OP_CALL_2,          // the call can be rewritten in place into OP_TAIL_CALL.
+    OP_CALL_3,
+    OP_CALL_SELF,       // [op_call_self][arg_count]: Call the current closure ("\/")
+                        // with an arg count that matches its arity
+    OP_TAIL_CALL,       // [op_tail_call][arg_count]: Call that reuses the current frame
     OP_CLOSURE,         // [op_clos][obj_func_const_idx][is_local1][idx1][is_local2][idx2]...
                         // : Create a new ObjClosure with upvalues
     OP_GET_UPVALUE,
@@ -58,19 +67,97 @@ typedef enum {
     OP_READ,            // [op_read]: Read (IO) instruction
 
     // Container and element access instructions
-    OP_CREATE_LIST,     // [op_create_list][member_count]: Create an ObjList on the stack
+    OP_CREATE_LIST,     // [op_create_list][count][set]: Create an ObjList from 2-byte count values
+    OP_COPY_LIST,       // [op_copy_list][list_const_idx][count][set]: Copy a prebuilt constant
+                        // list, then append 2-byte count values from the stack
     OP_GET_ELEMENT,     // [op_get_ele]: Access an element of a list, string, or table
     OP_SET_ELEMENT,     // [op_set_ele]: Set an element of a list or a table
     OP_GET_RANGE,       // [op_get_range]: Get a range of elements in a list or string
     OP_CREATE_TABLE,    // [op_create_table]: Create a new empty ObjTable
+    OP_GET_FIELD,       // [op_get_field][name_const_idx][cache hi][cache lo]: Get t.name
+    OP_SET_FIELD,       // [op_set_field][name_const_idx][cache hi][cache lo]: Set t.name
+
+    // Superinstructions (fused opcodes emitted by the compiler
+    // when USE_SUPERINSTRUCTIONS is enabled)
+    OP_NOT_EQUAL,       // [comparison !=]
+    OP_GREATER_EQUAL,   // [comparison >=]
+    OP_LESS_EQUAL,      // [comparison <=]
+
+    // Compare-and-branch: [jump][off][set]: Pop 2 operands, then jump
+    // forward if the comparison is false. Replace [cmp][jump_if_false][pop].
+    OP_JUMP_IF_NOT_EQUAL,
+    OP_JUMP_IF_NOT_NOT_EQUAL,
+    OP_JUMP_IF_NOT_GREATER,
+    OP_JUMP_IF_NOT_GREATER_EQUAL,
+    OP_JUMP_IF_NOT_LESS,
+    OP_JUMP_IF_NOT_LESS_EQUAL,
+
+    // Local and number constant arithmetic: [opcode][stack_idx][const_idx]
+    OP_ADD_LOCAL_CONST,         // Push local + constant
+    OP_SUBTRACT_LOCAL_CONST,    // Push local - constant
+    OP_INCREMENT_LOCAL,         // local = local + constant (as a statement)
+
+    // Register instructions (emitted in register mode): operate directly
+    // on the local variable slots x, y, and d of the current call frame.
+    OP_ADD_RR,                  // [op][x][y]: Push x + y
+    OP_SUBTRACT_RR,             // [op][x][y]: Push x - y
+    OP_MULTIPLY_RR,             // [op][x][y]: Push x * y
+    OP_GREATER_RR,              // [op][x][y]: Push x > y
+    OP_LESS_RR,                 // [op][x][y]: Push x < y
+    OP_ADD_RRR,                 // [op][d][x][y]: d = x + y (as a statement)
+    OP_SUBTRACT_RRR,            // [op][d][x][y]: d = x - y (as a statement)
+    OP_MULTIPLY_RRR,            // [op][d][x][y]: d = x * y (as a statement)
+    OP_JUMP_IF_NOT_GREATER_RR,  // [op][x][y][off][set]: Jump forward if not x > y
+    OP_JUMP_IF_NOT_LESS_RR,     // [op][x][y][off][set]: Jump forward if not x < y
+
+    // Quickened instructions: the VM rewrites a generic instruction in place
+    // to one of these after seeing its operand types, and rewrites it to its
+    // _POLY version when the types don't match anymore. Never emitted by the
+    // compiler.
+    OP_ADD_INT_INT,
+    OP_ADD_FLOAT_FLOAT,
+    OP_SUBTRACT_INT_INT,
+    OP_SUBTRACT_FLOAT_FLOAT,
+    OP_MULTIPLY_INT_INT,
+    OP_MULTIPLY_FLOAT_FLOAT,
+    OP_GREATER_INT_INT,
+    OP_GREATER_FLOAT_FLOAT,
+    OP_LESS_INT_INT,
+    OP_LESS_FLOAT_FLOAT,
+
+    // The generic instructions of the sites that were de-specialized,
+    // which are never quickened again. Never emitted by the compiler.
+    OP_ADD_POLY,
+    OP_SUBTRACT_POLY,
+    OP_MULTIPLY_POLY,
+    OP_GREATER_POLY,
+    OP_LESS_POLY,
 } OpCode;
 
+// An inline cache for a dot-notation access site (OP_GET_FIELD
+// and OP_SET_FIELD). It remembers where the key was found in the
+// last accessed table, so a repeated access skips hashing/probing.
+// For shaped tables, the slot of the key is the same in every table
+// of the cached shape. At most one of "shape" and "entries" is set,
+// as "slot" is either a field index or an entry index.
+typedef struct {
+    Shape* shape;           // The shape of the last accessed shaped table
+    Entry* entries;         // The entries array of the last accessed hash table
+    uint32_t slot;          // The index of the key's field or entry
+    uint32_t hits;          // Stats: number of cache hits
+    uint32_t misses;        // Stats: number of cache misses
+    int offset;             // The offset of the access site in the chunk
+} InlineCache;
+
 typedef struct {
     int size;               // Number of elements
     int capacity;           // Actual capacity
     uint8_t* chunk;    // Array of bytecode
     int* line_nums;         // Array of line numbers corresponding to the bytecodes
     ValueArray const_pool;  // Array of constant values
+    int cache_count;        // Number of inline caches
+    int cache_capacity;     // Capacity of the inline cache array
+    InlineCache* caches;    // Array of inline caches for field access
 } CodeChunk;
 
 // Initialize a new CodeChunk.
@@ -86,4 +173,8 @@ void free_chunk(CodeChunk* chunk);
 // and return its index in the pool.
 int add_constant(CodeChunk* chunk, IcoValue val);
 
+// Add a new empty inline cache for the access site at the
+// passed offset and return its index in the chunk.
+int add_inline_cache(CodeChunk* chunk, int offset);
+
 #endif // !ICO_CHUNK_H
@@ -28,4 +28,19 @@
 // #define DEBUG_LOG_GC
 #endif
 
+// Count the hits and misses of the inline caches for dot-notation
+// table access, and print them after running the code.
+// #define DEBUG_INLINE_CACHE_STATS
+
+// Print the occupancy of the size classes of the
+// slab allocator (for Obj) before exiting.
+// #define DEBUG_SLAB_STATS
+
+// Print the number of collections and the GC pause times before exiting.
+// #define DEBUG_GC_STATS
+
+// Count the objects and bytes allocated and freed per object type,
+// and check before exiting that every object and byte was freed.
+// #define DEBUG_VERIFY_HEAP
+
 #endif // !ICO_COMMON_H
\ No newline at end of file
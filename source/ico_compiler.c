@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -68,6 +69,8 @@ typedef struct Compiler {
     int local_var_count;
     int scope_depth;
     Upvalue upvalues[UINT8_COUNT]; // To mirror the array of ObjUpvalue at runtime
+    int op_offsets[2];  // Offsets of the last 2 emitted opcodes (latest first), or -1
+    int jump_target;    // The latest offset that a forward jump lands on
 } Compiler;
 
 Compiler* curr_compiler = NULL;
@@ -275,15 +278,23 @@ static CodeChunk* current_chunk() {
     return &curr_compiler->function->chunk;
 }
 
-// Add a byte to the currently being-compiled chunk.
-static void emit_byte(uint8_t byte) {
+// Add an operand byte to the currently being-compiled chunk.
+static void emit_operand(uint8_t byte) {
     append_chunk(current_chunk(), byte, parser.prev_token.line_num);
 }
 
-// Add two bytes to the currently being-compiled chunk.
+// Add an opcode byte to the currently being-compiled chunk, and
+// remember where it starts (for fusing superinstructions).
+static void emit_byte(uint8_t byte) {
+    curr_compiler->op_offsets[1] = curr_compiler->op_offsets[0];
+    curr_compiler->op_offsets[0] = current_chunk()->size;
+    emit_operand(byte);
+}
+
+// Add an opcode and its one-byte operand to the currently being-compiled chunk.
 static void emit_two_bytes(uint8_t byte1, uint8_t byte2) {
     emit_byte(byte1);
-    emit_byte(byte2);
+    emit_operand(byte2);
 }
 
 // Add OP_RETURN to the currently being-compiled chunk.
@@ -292,11 +303,29 @@ static void emit_op_return() {
     emit_byte(OP_RETURN);
 }
 
+// Add OP_RETURN for the return value that has just been compiled.
+// If the value is a call (ie. a call in tail position), the call is
+// turned into OP_TAIL_CALL, which reuses the current call frame.
+// Rewriting the opcode in place keeps all jump offsets valid.
+static void emit_value_return() {
+    CodeChunk* chunk = current_chunk();
+    int last = curr_compiler->op_offsets[0];
+    if (last >= 0 && last == chunk->size - 2) {
+        uint8_t opcode = chunk->chunk[last];
+        if (opcode == OP_CALL || opcode == OP_CALL_SELF
+                || (opcode >= OP_CALL_0 && opcode <= OP_CALL_3)) {
+            chunk->chunk[last] = OP_TAIL_CALL;
+        }
+    }
+    emit_byte(OP_RETURN);
+}
+
 // Add a constant to the contant pool of the current chunk
 // and return the corresponding constant index.
 static uint8_t add_constant_to_pool(IcoValue val) {
     // Add the constant to the pool and get the constant index
     int constant_idx = add_constant(current_chunk(), val);
+    write_barrier((Obj*)curr_compiler->function, val);
 
     // Check if the pool has enough spaces
     if (constant_idx > UINT8_MAX) {
@@ -314,14 +343,78 @@ static void emit_constant(IcoValue val) {
     emit_two_bytes(OP_CONSTANT, add_constant_to_pool(val));
 }
 
+// Emit a field access instruction with a new inline cache
+// for the access site: [opcode][name_const_idx][cache hi][cache lo]
+static void emit_field_op(uint8_t opcode, uint8_t name_idx) {
+    int cache_idx = add_inline_cache(current_chunk(), current_chunk()->size);
+    if (cache_idx > UINT16_MAX) {
+        error_prev_token("Too many field accesses in one chunk.");
+    }
+
+    emit_byte(opcode);
+    emit_operand(name_idx);
+    emit_operand((cache_idx >> 8) & 0xff);
+    emit_operand(cache_idx & 0xff);
+}
+
+// If the code compiled from the given offset to the end of the chunk is
+// a single constant instruction, move its value to the end of the list,
+// remove the instruction (and its constant, if it was the last one added
+// to the pool) and return true. Used to build constant list literals.
+static bool move_constant_to_list(int offset, ObjList* list) {
+    CodeChunk* chunk = current_chunk();
+    if (curr_compiler->op_offsets[0] != offset) return false;
+
+    int length = chunk->size - offset;
+    uint8_t opcode = chunk->chunk[offset];
+    if (length == 2 && opcode == OP_CONSTANT) {
+        // Append first, so that the constant is never unreachable for the GC
+        uint8_t const_idx = chunk->chunk[offset + 1];
+        append_value_array(&list->array, chunk->const_pool.values[const_idx]);
+        write_barrier((Obj*)list, chunk->const_pool.values[const_idx]);
+        if (const_idx == chunk->const_pool.size - 1) {
+            chunk->const_pool.size--;
+        }
+    }
+    else if (length == 1 && opcode == OP_NULL) append_value_array(&list->array, NULL_VAL);
+    else if (length == 1 && opcode == OP_TRUE) append_value_array(&list->array, BOOL_VAL(true));
+    else if (length == 1 && opcode == OP_FALSE) append_value_array(&list->array, BOOL_VAL(false));
+    else return false;
+
+    chunk->size = offset;
+    curr_compiler->op_offsets[0] = -1;
+    curr_compiler->op_offsets[1] = -1;
+    return true;
+}
+
+// If the operand compiled from the given offset is a single number
+// constant, negate the constant in the pool instead of emitting
+// OP_NEGATE (so "-1" is also a constant). Return true if folded.
+static bool fold_negate_constant(int offset) {
+    CodeChunk* chunk = current_chunk();
+    if (curr_compiler->op_offsets[0] != offset || chunk->size != offset + 2
+            || chunk->chunk[offset] != OP_CONSTANT) {
+        return false;
+    }
+
+    // Only fold a number constant that isn't shared with other code
+    uint8_t const_idx = chunk->chunk[offset + 1];
+    IcoValue val = chunk->const_pool.values[const_idx];
+    if (const_idx != chunk->const_pool.size - 1 || !IS_NUMBER(val)) return false;
+
+    chunk->const_pool.values[const_idx] = IS_INT(val) ?
+        INT_VAL(-AS_INT(val)) : FLOAT_VAL(-AS_FLOAT(val));
+    return true;
+}
+
 // Emit a jump instruction and 2 placeholder operand bytes,
 // then return the chunk offset right after the jump opcode.
 static int emit_jump(uint8_t opcode) {
     emit_byte(opcode);
 
     // Placeholder for jump offset
-    emit_byte(0xff);
-    emit_byte(0xff);
+    emit_operand(0xff);
+    emit_operand(0xff);
 
     return current_chunk()->size - 2;
 }
@@ -336,6 +429,9 @@ static void patch_jump(int offset) {
         error_prev_token("Too much bytecode to jump over.");
     }
 
+    // Don't fuse any instruction that this jump lands right after
+    curr_compiler->jump_target = current_chunk()->size;
+
     // Convert the jump distance to an unsigned short
     // byte-by-byte and put it in the chunk
     current_chunk()->chunk[offset] = (dist >> 8) & 0xff;
@@ -351,8 +447,203 @@ static void emit_loop(int loop_start) {
     int offset = current_chunk()->size + 2 - loop_start;
     if (offset > UINT16_MAX) error_prev_token("Loop body too large.");
 
-    emit_byte((offset >> 8) & 0xff);
-    emit_byte(offset & 0xff);
+    emit_operand((offset >> 8) & 0xff);
+    emit_operand(offset & 0xff);
+}
+
+//-------------------------------------
+//   SUPERINSTRUCTION FUSING FUNCTIONS
+//-------------------------------------
+
+// Return true if the bytecode from the instruction at the given offset
+// to the end of the chunk can be rewritten, ie. no forward jump lands
+// anywhere after the start of that instruction.
+static bool can_fuse_from(int offset) {
+    return offset >= 0 && curr_compiler->jump_target <= offset;
+}
+
+// Try to fuse [OP_GET_LOCAL][OP_CONSTANT] with the arithmetic opcode
+// that is about to be emitted. Return true if fused.
+static bool fuse_local_const_op(uint8_t opcode) {
+#ifdef USE_SUPERINSTRUCTIONS
+    CodeChunk* chunk = current_chunk();
+    int get_local = curr_compiler->op_offsets[1];
+    int constant = curr_compiler->op_offsets[0];
+
+    if (!can_fuse_from(get_local) || get_local != chunk->size - 4 || constant != chunk->size - 2
+            || chunk->chunk[get_local] != OP_GET_LOCAL || chunk->chunk[constant] != OP_CONSTANT) {
+        return false;
+    }
+
+    // Only fuse number constants (to keep the same error messages)
+    uint8_t const_idx = chunk->chunk[constant + 1];
+    if (!IS_NUMBER(chunk->const_pool.values[const_idx])) return false;
+
+    // Rewrite into [opcode][stack_idx][const_idx]
+    uint8_t stack_idx = chunk->chunk[get_local + 1];
+    chunk->size = get_local;
+    curr_compiler->op_offsets[0] = -1;
+    emit_two_bytes(opcode, stack_idx);
+    emit_operand(const_idx);
+    curr_compiler->op_offsets[1] = -1;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Try to fuse an expression statement "local = local + number;" into
+// OP_INCREMENT_LOCAL, instead of [OP_ADD_LOCAL_CONST][OP_SET_LOCAL][OP_POP].
+// Return true if fused.
+static bool fuse_increment_local() {
+#ifdef USE_SUPERINSTRUCTIONS
+    CodeChunk* chunk = current_chunk();
+    int add = curr_compiler->op_offsets[1];
+    int set_local = curr_compiler->op_offsets[0];
+
+    if (!can_fuse_from(add) || add != chunk->size - 5 || set_local != chunk->size - 2
+            || chunk->chunk[add] != OP_ADD_LOCAL_CONST || chunk->chunk[set_local] != OP_SET_LOCAL
+            || chunk->chunk[add + 1] != chunk->chunk[set_local + 1]) {
+        return false;
+    }
+
+    // Rewrite into [OP_INCREMENT_LOCAL][stack_idx][const_idx]
+    chunk->chunk[add] = OP_INCREMENT_LOCAL;
+    chunk->size = set_local;
+    curr_compiler->op_offsets[0] = add;
+    curr_compiler->op_offsets[1] = -1;
+    return true;
+#else
+    return false;
+#endif
+}
+
+//-------------------------------------
+//   REGISTER INSTRUCTION FUNCTIONS
+//-------------------------------------
+
+/* In register mode (the "-r" command-line flag), operations whose operands
+are both local variables are compiled into three-address instructions that
+read the operands directly from the slots of the call frame, instead of
+pushing them on the VM stack first. */
+
+// Try to rewrite [OP_GET_LOCAL x][OP_GET_LOCAL y], the operands of the
+// binary operation about to be emitted, into [opcode][x][y].
+// Return true if rewritten.
+static bool emit_register_op(uint8_t opcode) {
+    if (!vm.use_registers) return false;
+
+    CodeChunk* chunk = current_chunk();
+    int left = curr_compiler->op_offsets[1];
+    int right = curr_compiler->op_offsets[0];
+
+    if (!can_fuse_from(left) || left != chunk->size - 4 || right != chunk->size - 2
+            || chunk->chunk[left] != OP_GET_LOCAL || chunk->chunk[right] != OP_GET_LOCAL) {
+        return false;
+    }
+
+    uint8_t x = chunk->chunk[left + 1];
+    uint8_t y = chunk->chunk[right + 1];
+    chunk->size = left;
+    curr_compiler->op_offsets[0] = -1;
+    emit_two_bytes(opcode, x);
+    emit_operand(y);
+    curr_compiler->op_offsets[1] = -1;
+    return true;
+}
+
+// Try to rewrite an expression statement "d = x op y;" from
+// [op_rr][x][y][OP_SET_LOCAL][d] into [op_rrr][d][x][y], which
+// doesn't leave anything on the stack. Return true if rewritten.
+static bool emit_register_store() {
+    if (!vm.use_registers) return false;
+
+    CodeChunk* chunk = current_chunk();
+    int op = curr_compiler->op_offsets[1];
+    int set_local = curr_compiler->op_offsets[0];
+
+    if (!can_fuse_from(op) || op != chunk->size - 5 || set_local != chunk->size - 2
+            || chunk->chunk[set_local] != OP_SET_LOCAL) {
+        return false;
+    }
+
+    uint8_t store_op;
+    switch (chunk->chunk[op]) {
+        case OP_ADD_RR:         store_op = OP_ADD_RRR; break;
+        case OP_SUBTRACT_RR:    store_op = OP_SUBTRACT_RRR; break;
+        case OP_MULTIPLY_RR:    store_op = OP_MULTIPLY_RRR; break;
+        default:                return false;
+    }
+
+    // Rewrite in place: [op][x][y][set][d] -> [op][d][x][y]
+    uint8_t d = chunk->chunk[set_local + 1];
+    chunk->chunk[op + 3] = chunk->chunk[op + 2];
+    chunk->chunk[op + 2] = chunk->chunk[op + 1];
+    chunk->chunk[op + 1] = d;
+    chunk->chunk[op] = store_op;
+    chunk->size = op + 4;
+    curr_compiler->op_offsets[0] = op;
+    curr_compiler->op_offsets[1] = -1;
+    return true;
+}
+
+// Emit a conditional forward jump for a condition that is popped on
+// both branches (if statement, loop, and ternary expression), and return
+// the offset to be patched. If the condition is a comparison, it is fused
+// with the jump into a compare-and-branch superinstruction that also pops
+// the condition, and "fused" is set to true.
+static int emit_condition_jump(bool* fused) {
+    *fused = false;
+
+    // Register comparison: [op_rr][x][y] -> [jump_op_rr][x][y][off][set]
+    if (vm.use_registers) {
+        CodeChunk* chunk = current_chunk();
+        int last = curr_compiler->op_offsets[0];
+        if (can_fuse_from(last) && last == chunk->size - 3
+                && (chunk->chunk[last] == OP_LESS_RR || chunk->chunk[last] == OP_GREATER_RR)) {
+            chunk->chunk[last] = chunk->chunk[last] == OP_LESS_RR ?
+                OP_JUMP_IF_NOT_LESS_RR : OP_JUMP_IF_NOT_GREATER_RR;
+
+            // Placeholder for jump offset
+            emit_operand(0xff);
+            emit_operand(0xff);
+
+            *fused = true;
+            return chunk->size - 2;
+        }
+    }
+
+#ifdef USE_SUPERINSTRUCTIONS
+    CodeChunk* chunk = current_chunk();
+    int last = curr_compiler->op_offsets[0];
+    if (can_fuse_from(last) && last == chunk->size - 1) {
+        uint8_t jump_op;
+        switch (chunk->chunk[last]) {
+            case OP_EQUAL:          jump_op = OP_JUMP_IF_NOT_EQUAL; break;
+            case OP_NOT_EQUAL:      jump_op = OP_JUMP_IF_NOT_NOT_EQUAL; break;
+            case OP_GREATER:        jump_op = OP_JUMP_IF_NOT_GREATER; break;
+            case OP_GREATER_EQUAL:  jump_op = OP_JUMP_IF_NOT_GREATER_EQUAL; break;
+            case OP_LESS:           jump_op = OP_JUMP_IF_NOT_LESS; break;
+            case OP_LESS_EQUAL:     jump_op = OP_JUMP_IF_NOT_LESS_EQUAL; break;
+            default:                return emit_jump(OP_JUMP_IF_FALSE);
+        }
+
+        // Replace the comparison opcode with the fused jump
+        chunk->size = last;
+        curr_compiler->op_offsets[0] = curr_compiler->op_offsets[1];
+        curr_compiler->op_offsets[1] = -1;
+        *fused = true;
+        return emit_jump(jump_op);
+    }
+#endif
+
+    return emit_jump(OP_JUMP_IF_FALSE);
+}
+
+// Emit OP_POP for the condition of emit_condition_jump(), unless
+// it has already been popped by a fused jump.
+static void emit_condition_pop(bool fused) {
+    if (!fused) emit_byte(OP_POP);
 }
 
 // Initialize a new compiler struct, and set the current one
@@ -363,11 +654,15 @@ static void init_compiler(Compiler* compiler, FunctionType type, const char* nam
     compiler->func_type = type;
     compiler->local_var_count = 0;
     compiler->scope_depth = 0;
+    compiler->op_offsets[0] = -1;
+    compiler->op_offsets[1] = -1;
+    compiler->jump_target = 0;
     compiler->function = new_function_obj(); // Immediately reassign bc GC stuff
     curr_compiler = compiler;
 
     if (type != TYPE_TOP_LEVEL) {
         curr_compiler->function->name = copy_and_create_str_obj(name, length);
+        write_barrier_all((Obj*)curr_compiler->function);
     }
 
     // Use the first slot in the call frame for the ObjFunction
@@ -478,7 +773,12 @@ static void parse_expression() {
 
 // Parse and compile an int literal.
 static void parse_int_literal(bool can_assign) {
+    errno = 0;
     long i = strtol(parser.prev_token.start, NULL, 10);
+    if (errno == ERANGE || i > INT_VAL_MAX) {
+        error_prev_token("Int literal out of range.");
+        return;
+    }
     emit_constant(INT_VAL(i));
 }
 
@@ -517,11 +817,14 @@ static void parse_unary(bool can_assign) {
 
     // Parse the operand. Use unary precedence level
     // to allow things like "--5" or "!!isEmpty".
+    int operand_start = current_chunk()->size;
     parse_expr_with_precedence(PREC_UNARY);
 
     // Emit the corresponding opcode
     switch (operator_type) {
-        case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
+        case TOKEN_MINUS:
+            if (!fold_negate_constant(operand_start)) emit_byte(OP_NEGATE);
+            break;
         case TOKEN_BANG:  emit_byte(OP_NOT); break;
 
         default:          return;// Unreachable
@@ -544,19 +847,39 @@ static void parse_binary(bool can_assign) {
 
     switch (operator_type) {
         // Arithmetic operations
-        case TOKEN_PLUS:    emit_byte(OP_ADD); break;
-        case TOKEN_MINUS:   emit_byte(OP_SUBTRACT); break;
-        case TOKEN_STAR:    emit_byte(OP_MULTIPLY); break;
+        case TOKEN_PLUS:
+            if (!emit_register_op(OP_ADD_RR) && !fuse_local_const_op(OP_ADD_LOCAL_CONST)) {
+                emit_byte(OP_ADD);
+            }
+            break;
+        case TOKEN_MINUS:
+            if (!emit_register_op(OP_SUBTRACT_RR) && !fuse_local_const_op(OP_SUBTRACT_LOCAL_CONST)) {
+                emit_byte(OP_SUBTRACT);
+            }
+            break;
+        case TOKEN_STAR:
+            if (!emit_register_op(OP_MULTIPLY_RR)) emit_byte(OP_MULTIPLY);
+            break;
         case TOKEN_SLASH:   emit_byte(OP_DIVIDE); break;
         case TOKEN_PERCENT: emit_byte(OP_MODULO); break;
 
         // Comparison operations
-        case TOKEN_BANG_EQUAL:    emit_two_bytes(OP_EQUAL, OP_NOT); break;
         case TOKEN_EQUAL_EQUAL:   emit_byte(OP_EQUAL); break;
-        case TOKEN_GREATER:       emit_byte(OP_GREATER); break;
-        case TOKEN_GREATER_EQUAL: emit_two_bytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS:          emit_byte(OP_LESS); break;
-        case TOKEN_LESS_EQUAL:    emit_two_bytes(OP_GREATER, OP_NOT); break;
+        case TOKEN_GREATER:
+            if (!emit_register_op(OP_GREATER_RR)) emit_byte(OP_GREATER);
+            break;
+        case TOKEN_LESS:
+            if (!emit_register_op(OP_LESS_RR)) emit_byte(OP_LESS);
+            break;
+#ifdef USE_SUPERINSTRUCTIONS
+        case TOKEN_BANG_EQUAL:    emit_byte(OP_NOT_EQUAL); break;
+        case TOKEN_GREATER_EQUAL: emit_byte(OP_GREATER_EQUAL); break;
+        case TOKEN_LESS_EQUAL:    emit_byte(OP_LESS_EQUAL); break;
+#else
+        case TOKEN_BANG_EQUAL:    emit_byte(OP_EQUAL); emit_byte(OP_NOT); break;
+        case TOKEN_GREATER_EQUAL: emit_byte(OP_LESS); emit_byte(OP_NOT); break;
+        case TOKEN_LESS_EQUAL:    emit_byte(OP_GREATER); emit_byte(OP_NOT); break;
+#endif
 
         default:  /// Unreachable
             return;
@@ -583,20 +906,43 @@ static void parse_string_literal(bool can_assign) {
 // Parse and compile a list literal.
 static void parse_list_literal(bool can_assign) {
     // '[' has been consumed
-    int count = 0;
+
+    // The leading constant elements are collected into a prebuilt list,
+    // which is copied as a whole at runtime. It is pushed on the stack
+    // so that the GC doesn't collect it while compiling.
+    ObjList* prefix = new_list_obj();
+    push(OBJ_VAL(prefix));
+    bool in_prefix = true;
+
+    int count = 0; // Number of elements pushed on the stack at runtime
     if (!check_next_token(TOKEN_RIGHT_SQUARE)) { // Non-empty list
         do {
+            int elem_start = current_chunk()->size;
+            parse_expression(); // Bytecode to push each member on the stack
+
+            // Move a leading constant element into the prebuilt list
+            if (in_prefix && move_constant_to_list(elem_start, prefix)) continue;
+
+            in_prefix = false;
             count++;
-            if (count > 255) {
-                error_curr_token("List literals can't have more than 255 elements.");
+            if (count > UINT16_MAX) {
+                error_curr_token("List literals can't have more than 65535 non-constant elements.");
             }
-            parse_expression(); // Bytecode to push each member on the stack
         }
         while (match_next_token(TOKEN_COMMA));
     }
     consume_mandatory(TOKEN_RIGHT_SQUARE, "Expect ']' at the end of a list literal.");
 
-    emit_two_bytes(OP_CREATE_LIST, count); // Will pop all members and add to the list
+    // Will pop all members and add to the list
+    if (prefix->array.size > 0) {
+        emit_two_bytes(OP_COPY_LIST, add_constant_to_pool(OBJ_VAL(prefix)));
+    }
+    else {
+        emit_byte(OP_CREATE_LIST);
+    }
+    emit_operand((count >> 8) & 0xff);
+    emit_operand(count & 0xff);
+    pop();
 }
 
 // Parse and compile an empty table literal
@@ -638,14 +984,14 @@ static void parse_dot(bool can_assign) {
         parser.prev_token.start,
         parser.prev_token.length
     );
-    emit_constant(OBJ_VAL(string_const));
+    uint8_t name_idx = add_constant_to_pool(OBJ_VAL(string_const));
 
     if (can_assign && match_next_token(TOKEN_EQUAL)) {
         parse_expression();
-        emit_byte(OP_SET_ELEMENT);
+        emit_field_op(OP_SET_FIELD, name_idx);
     }
     else {
-        emit_byte(OP_GET_ELEMENT);
+        emit_field_op(OP_GET_FIELD, name_idx);
     }
 }
 
@@ -678,12 +1024,25 @@ static void synchronize() {
     }
 }
 
-// Add an identifier name to the constant pool from its
-// lexeme in the source code, then return the constant index.
-static uint8_t identifier_constant_index(Token* token) {
-    return add_constant_to_pool(
-        OBJ_VAL(copy_and_create_str_obj(token->start, token->length))
-    );
+// Resolve a global variable name to its slot index in the
+// VM's array of global variables (adding a new slot if needed).
+static uint16_t global_slot_index(Token* token) {
+    int slot = global_slot(copy_and_create_str_obj(token->start, token->length));
+
+    // Check if the slot index fits in the 2-byte operand
+    if (slot > UINT16_MAX) {
+        error_prev_token("Too many global variables.");
+        return 0;
+    }
+
+    return (uint16_t)slot;
+}
+
+// Emit a global variable instruction: [opcode][slot hi][slot lo]
+static void emit_global_op(uint8_t opcode, uint16_t slot) {
+    emit_byte(opcode);
+    emit_operand((slot >> 8) & 0xff);
+    emit_operand(slot & 0xff);
 }
 
 // Return two if two identifiers are the same
@@ -742,22 +1101,22 @@ static void declare_variable() {
 }
 
 // Parse the name of a global or local variable and declare it.
-// Return the constant index in the constant pool of the name,
-// or return 0 if it is a local variable.
-static uint8_t parse_var_name(const char* error_msg) {
+// Return the global slot index of the name, or return 0
+// if it is a local variable.
+static uint16_t parse_var_name(const char* error_msg) {
     consume_mandatory(TOKEN_IDENTIFIER, error_msg);
 
     // Declare and return if this is a local variable
     declare_variable();
     if (curr_compiler->scope_depth > 0) return 0;
 
-    // Return the constant index of the var name if this is a global variable.
-    return identifier_constant_index(&parser.prev_token);
+    // Return the slot index of the var name if this is a global variable.
+    return global_slot_index(&parser.prev_token);
 }
 
 // Emit bytecode instruction for global variable initialization,
 // or mark a local variable as initialized.
-static void define_variable(uint8_t var_name_const_idx) {
+static void define_variable(uint16_t global_slot) {
     // Don't need to emit any bytecode for local vars
     if (curr_compiler->scope_depth > 0) {
         mark_initialized();
@@ -765,7 +1124,7 @@ static void define_variable(uint8_t var_name_const_idx) {
     }
 
     // Bytecode for defining global variable
-    emit_two_bytes(OP_DEFINE_GLOBAL, var_name_const_idx);
+    emit_global_op(OP_DEFINE_GLOBAL, global_slot);
 }
 
 // Resolve a local variable and return its index on the
@@ -858,19 +1217,22 @@ static void named_variable(Token name, bool can_assign) {
         set_op = OP_SET_UPVALUE;
     }
     else { // Global
-        arg = identifier_constant_index(&name);
+        arg = global_slot_index(&name);
         get_op = OP_GET_GLOBAL;
         set_op = OP_SET_GLOBAL;
     }
 
     // Set or Get?
+    bool is_global = get_op == OP_GET_GLOBAL;
     if (can_assign && match_next_token(TOKEN_EQUAL)) { // Set
         // Compile the right-hand-side expression
         parse_expression();
-        emit_two_bytes(set_op, (uint8_t)arg);
+        if (is_global) emit_global_op(set_op, (uint16_t)arg);
+        else emit_two_bytes(set_op, (uint8_t)arg);
     }
     else { // Get
-        emit_two_bytes(get_op, (uint8_t)arg);
+        if (is_global) emit_global_op(get_op, (uint16_t)arg);
+        else emit_two_bytes(get_op, (uint8_t)arg);
     }
 }
 
@@ -931,7 +1293,12 @@ static void end_scope() {
 static void parse_expression_stmt() {
     parse_expression();
     consume_mandatory(TOKEN_SEMICOLON, "Expect ';' after expression.");
-    emit_byte(vm.is_repl ? OP_STORE_VAL : OP_POP);
+    if (vm.is_repl) {
+        emit_byte(OP_STORE_VAL);
+    }
+    else if (!emit_register_store() && !fuse_increment_local()) {
+        emit_byte(OP_POP);
+    }
 }
 
 // Parse and compile an if statement.
@@ -942,8 +1309,9 @@ static void parse_if_stmt() {
     consume_mandatory(TOKEN_QUESTION, "Expect '?' after condition.");
 
     // Parse the then branch
-    int then_jump_offset = emit_jump(OP_JUMP_IF_FALSE); // to jump through then
-    emit_byte(OP_POP); // to pop the condition expr in the then branch
+    bool fused;
+    int then_jump_offset = emit_condition_jump(&fused); // to jump through then
+    emit_condition_pop(fused); // to pop the condition expr in the then branch
     parse_statement();
     int else_jump_offset = emit_jump(OP_JUMP); // to jump through else
 
@@ -951,7 +1319,7 @@ static void parse_if_stmt() {
     patch_jump(then_jump_offset);
 
     // Optionally parse the else branch
-    emit_byte(OP_POP); // to pop the condition expr in the else branch
+    emit_condition_pop(fused); // to pop the condition expr in the else branch
     if (match_next_token(TOKEN_COLON)) parse_statement();
     patch_jump(else_jump_offset);
 }
@@ -986,17 +1354,18 @@ static void parse_or(bool can_assign) {
 // Parse and compile a ternary expression
 static void parse_ternary(bool can_assign) {
     // The condition expression and the '?' is already parsed
-    int then_jump_offset = emit_jump(OP_JUMP_IF_FALSE);
+    bool fused;
+    int then_jump_offset = emit_condition_jump(&fused);
 
     // Then branch
-    emit_byte(OP_POP); // Pop the condition
+    emit_condition_pop(fused); // Pop the condition
     parse_expr_with_precedence(PREC_OR);
     int else_jump_offset = emit_jump(OP_JUMP); // Skip the else branch
 
     // Else branch
     patch_jump(then_jump_offset);
     consume_mandatory(TOKEN_COLON, "Expect ':' in ternary expression.");
-    emit_byte(OP_POP);
+    emit_condition_pop(fused);
     parse_expr_with_precedence(PREC_OR);
     patch_jump(else_jump_offset);
 }
@@ -1012,16 +1381,17 @@ static void parse_while_stmt() {
     consume_mandatory(TOKEN_COLON, "Expect ':' after loop condition.");
 
     // Jump to exit the loop when the condition is false
-    int exit_jump_offset = emit_jump(OP_JUMP_IF_FALSE);
+    bool fused;
+    int exit_jump_offset = emit_condition_jump(&fused);
 
     // Loop body
-    emit_byte(OP_POP); // pop the loop condition
+    emit_condition_pop(fused); // pop the loop condition
     parse_statement();
     emit_loop(loop_start);
 
     // For exitting the loop
     patch_jump(exit_jump_offset);
-    emit_byte(OP_POP); // pop the loop condition
+    emit_condition_pop(fused); // pop the loop condition
 }
 
 // Parse and compile a return statement
@@ -1038,7 +1408,7 @@ static void parse_return_stmt() {
     else {
         parse_expression(); // the return value expr
         consume_mandatory(TOKEN_SEMICOLON, "Expect ';' after return value.");
-        emit_byte(OP_RETURN);
+        emit_value_return();
     }
 }
 
@@ -1088,7 +1458,7 @@ static void compile_function(FunctionType type, const char* name, int length) {
 
             // Parse the parameter name
             // (The constant index is not used because parameters are local vars).
-            uint8_t constant = parse_var_name("Expect parameter name.");
+            uint16_t constant = parse_var_name("Expect parameter name.");
             define_variable(constant);
         }
         while (match_next_token(TOKEN_COMMA));
@@ -1101,7 +1471,7 @@ static void compile_function(FunctionType type, const char* name, int length) {
     }
     else { // Expression as body
         parse_expression();
-        emit_byte(OP_RETURN);
+        emit_value_return();
     }
 
     // Store the resulting ObjFunction in the constant pool of the surrounding function
@@ -1110,8 +1480,8 @@ static void compile_function(FunctionType type, const char* name, int length) {
 
     // Emit 2 bytes [is_local][index] for each upvalue used
     for (int i = 0; i < result_func->upvalue_count; i++) {
-        emit_byte(func_compiler.upvalues[i].is_local ? 1 : 0);
-        emit_byte(func_compiler.upvalues[i].index);
+        emit_operand(func_compiler.upvalues[i].is_local ? 1 : 0);
+        emit_operand(func_compiler.upvalues[i].index);
     }
 }
 
@@ -1150,13 +1520,31 @@ static uint8_t parse_arg_list() {
 
 // Parse and compile a function call
 static void parse_call(bool can_assign) {
+    // Check if the callee is exactly "\/" (slot 0 of a function)
+    CodeChunk* chunk = current_chunk();
+    int callee = curr_compiler->op_offsets[0];
+    bool is_self = curr_compiler->func_type == TYPE_FUNCTION
+        && can_fuse_from(callee) && callee == chunk->size - 2
+        && chunk->chunk[callee] == OP_GET_LOCAL && chunk->chunk[callee + 1] == 0;
+
     uint8_t arg_count = parse_arg_list();
-    emit_two_bytes(OP_CALL, arg_count);
+
+    // Self-recursion with the right arg count needs no type and arity checks.
+    // A wrong arg count is left to OP_CALL to report at runtime.
+    if (is_self && arg_count == curr_compiler->function->arity) {
+        emit_two_bytes(OP_CALL_SELF, arg_count);
+    }
+    else if (arg_count <= 3) {
+        emit_two_bytes(OP_CALL_0 + arg_count, arg_count);
+    }
+    else {
+        emit_two_bytes(OP_CALL, arg_count);
+    }
 }
 
 // Parse and compile a variable declaration.
 static void parse_var_decl() {
-    uint8_t arg = parse_var_name("Expect variable name.");
+    uint16_t arg = parse_var_name("Expect variable name.");
     Token var_name = parser.prev_token;
 
     // Prepare the initialization value (or nil if not available)
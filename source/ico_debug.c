@@ -4,6 +4,7 @@
 #include "ico_chunk.h"
 #include "ico_value.h"
 #include "ico_object.h"
+#include "ico_vm.h"
 
 //------------------------------
 //      STATIC FUNCTIONS
@@ -40,6 +41,76 @@ static int byte_instruction(const char* name, CodeChunk* chunk, int offset) {
     return offset + 2;
 }
 
+// Print an instruction with a 2-byte operand. General format: [opcode][byte][byte]
+static int short_instruction(const char* name, CodeChunk* chunk, int offset) {
+    uint16_t operand = (uint16_t)(chunk->chunk[offset + 1] << 8);
+    operand |= chunk->chunk[offset + 2];
+    printf("%-16s %4d\n", name, operand);
+    return offset + 3;
+}
+
+// Print a list copy instruction. General format: [opcode][const_idx][count][set]
+static int copy_list_instruction(const char* name, CodeChunk* chunk, int offset) {
+    uint8_t constant_idx = chunk->chunk[offset + 1];
+    uint16_t count = (uint16_t)(chunk->chunk[offset + 2] << 8);
+    count |= chunk->chunk[offset + 3];
+
+    printf("%-16s %4d '", name, constant_idx);
+    print_value(chunk->const_pool.values[constant_idx]);
+    printf("' + %d\n", count);
+
+    return offset + 4;
+}
+
+// Print a global variable instruction. General format: [opcode][slot hi][slot lo]
+static int global_instruction(const char* name, CodeChunk* chunk, int offset) {
+    uint16_t slot = (uint16_t)(chunk->chunk[offset + 1] << 8);
+    slot |= chunk->chunk[offset + 2];
+    printf("%-16s %4d '%s'\n", name, slot, global_slot_name(slot)->chars);
+    return offset + 3;
+}
+
+// Print a field access instruction. General format: [opcode][name_const_idx][cache hi][cache lo]
+static int field_instruction(const char* name, CodeChunk* chunk, int offset) {
+    uint8_t constant_idx = chunk->chunk[offset + 1];
+    uint16_t cache_idx = (uint16_t)(chunk->chunk[offset + 2] << 8);
+    cache_idx |= chunk->chunk[offset + 3];
+
+    printf("%-16s %4d '", name, constant_idx);
+    print_value(chunk->const_pool.values[constant_idx]);
+    printf("' (cache %d)\n", cache_idx);
+
+    return offset + 4;
+}
+
+// Print a register instruction. General format: [opcode][x][y]
+static int register_instruction(const char* name, CodeChunk* chunk, int offset) {
+    uint8_t x = chunk->chunk[offset + 1];
+    uint8_t y = chunk->chunk[offset + 2];
+    printf("%-16s %4d %4d\n", name, x, y);
+    return offset + 3;
+}
+
+// Print a register store instruction. General format: [opcode][d][x][y]
+static int register_store_instruction(const char* name, CodeChunk* chunk, int offset) {
+    uint8_t d = chunk->chunk[offset + 1];
+    uint8_t x = chunk->chunk[offset + 2];
+    uint8_t y = chunk->chunk[offset + 3];
+    printf("%-16s %4d = %d, %d\n", name, d, x, y);
+    return offset + 4;
+}
+
+// Print a register compare-and-branch instruction (forward jump only).
+// General format: [opcode][x][y][off][set]
+static int register_jump_instruction(const char* name, CodeChunk* chunk, int offset) {
+    uint8_t x = chunk->chunk[offset + 1];
+    uint8_t y = chunk->chunk[offset + 2];
+    uint16_t jump_dist = (uint16_t)(chunk->chunk[offset + 3] << 8);
+    jump_dist |= chunk->chunk[offset + 4];
+    printf("%-16s %4d %4d %4d -> %d\n", name, x, y, offset, offset + 5 + jump_dist);
+    return offset + 5;
+}
+
 // Print a jump instruction. General format: [jump_opcode][off][set]
 static int jump_instruction(const char* name, int sign, CodeChunk* chunk, int offset) {
     // Calculate the jump distance
@@ -49,6 +120,16 @@ static int jump_instruction(const char* name, int sign, CodeChunk* chunk, int of
     return offset + 3;
 }
 
+// Print a local-constant instruction. General format: [opcode][stack_idx][const_idx]
+static int local_constant_instruction(const char* name, CodeChunk* chunk, int offset) {
+    uint8_t stack_index = chunk->chunk[offset + 1];
+    uint8_t constant_idx = chunk->chunk[offset + 2];
+    printf("%-16s %4d %4d '", name, stack_index, constant_idx);
+    print_value(chunk->const_pool.values[constant_idx]);
+    printf("'\n");
+    return offset + 3;
+}
+
 //------------------------------
 //      HEADER FUNCTIONS
 //------------------------------
@@ -146,13 +227,13 @@ int disass_instruction(CodeChunk* chunk, int offset) {
             return simple_instruction("OP_POP", offset);
 
         case OP_GET_GLOBAL:
-            return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+            return global_instruction("OP_GET_GLOBAL", chunk, offset);
 
         case OP_DEFINE_GLOBAL:
-            return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return global_instruction("OP_DEFINE_GLOBAL", chunk, offset);
 
         case OP_SET_GLOBAL:
-            return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+            return global_instruction("OP_SET_GLOBAL", chunk, offset);
 
         case OP_GET_LOCAL:
             return byte_instruction("OP_GET_LOCAL", chunk, offset);
@@ -172,6 +253,24 @@ int disass_instruction(CodeChunk* chunk, int offset) {
         case OP_CALL:
             return byte_instruction("OP_CALL", chunk, offset);
 
+        case OP_CALL_0:
+            return byte_instruction("OP_CALL_0", chunk, offset);
+
+        case OP_CALL_1:
+            return byte_instruction("OP_CALL_1", chunk, offset);
+
+        case OP_CALL_2:
+            return byte_instruction("OP_CALL_2", chunk, offset);
+
+        case OP_CALL_3:
+            return byte_instruction("OP_CALL_3", chunk, offset);
+
+        case OP_CALL_SELF:
+            return byte_instruction("OP_CALL_SELF", chunk, offset);
+
+        case OP_TAIL_CALL:
+            return byte_instruction("OP_TAIL_CALL", chunk, offset);
+
         case OP_CLOSURE: {
             offset++;
 
@@ -212,7 +311,10 @@ int disass_instruction(CodeChunk* chunk, int offset) {
             return simple_instruction("OP_READ", offset);
 
         case OP_CREATE_LIST:
-            return byte_instruction("OP_CREATE_LIST", chunk, offset);
+            return short_instruction("OP_CREATE_LIST", chunk, offset);
+
+        case OP_COPY_LIST:
+            return copy_list_instruction("OP_COPY_LIST", chunk, offset);
 
         case OP_GET_ELEMENT:
             return simple_instruction("OP_GET_ELEMENT", offset);
@@ -226,8 +328,139 @@ int disass_instruction(CodeChunk* chunk, int offset) {
         case OP_CREATE_TABLE:
             return simple_instruction("OP_CREATE_TABLE", offset);
 
+        case OP_GET_FIELD:
+            return field_instruction("OP_GET_FIELD", chunk, offset);
+
+        case OP_SET_FIELD:
+            return field_instruction("OP_SET_FIELD", chunk, offset);
+
+        case OP_NOT_EQUAL:
+            return simple_instruction("OP_NOT_EQUAL", offset);
+
+        case OP_GREATER_EQUAL:
+            return simple_instruction("OP_GREATER_EQUAL", offset);
+
+        case OP_LESS_EQUAL:
+            return simple_instruction("OP_LESS_EQUAL", offset);
+
+        case OP_JUMP_IF_NOT_EQUAL:
+            return jump_instruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
+
+        case OP_JUMP_IF_NOT_NOT_EQUAL:
+            return jump_instruction("OP_JUMP_IF_NOT_NOT_EQUAL", 1, chunk, offset);
+
+        case OP_JUMP_IF_NOT_GREATER:
+            return jump_instruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+
+        case OP_JUMP_IF_NOT_GREATER_EQUAL:
+            return jump_instruction("OP_JUMP_IF_NOT_GREATER_EQUAL", 1, chunk, offset);
+
+        case OP_JUMP_IF_NOT_LESS:
+            return jump_instruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+
+        case OP_JUMP_IF_NOT_LESS_EQUAL:
+            return jump_instruction("OP_JUMP_IF_NOT_LESS_EQUAL", 1, chunk, offset);
+
+        case OP_ADD_LOCAL_CONST:
+            return local_constant_instruction("OP_ADD_LOCAL_CONST", chunk, offset);
+
+        case OP_SUBTRACT_LOCAL_CONST:
+            return local_constant_instruction("OP_SUBTRACT_LOCAL_CONST", chunk, offset);
+
+        case OP_INCREMENT_LOCAL:
+            return local_constant_instruction("OP_INCREMENT_LOCAL", chunk, offset);
+
+        case OP_ADD_RR:
+            return register_instruction("OP_ADD_RR", chunk, offset);
+
+        case OP_SUBTRACT_RR:
+            return register_instruction("OP_SUBTRACT_RR", chunk, offset);
+
+        case OP_MULTIPLY_RR:
+            return register_instruction("OP_MULTIPLY_RR", chunk, offset);
+
+        case OP_GREATER_RR:
+            return register_instruction("OP_GREATER_RR", chunk, offset);
+
+        case OP_LESS_RR:
+            return register_instruction("OP_LESS_RR", chunk, offset);
+
+        case OP_ADD_RRR:
+            return register_store_instruction("OP_ADD_RRR", chunk, offset);
+
+        case OP_SUBTRACT_RRR:
+            return register_store_instruction("OP_SUBTRACT_RRR", chunk, offset);
+
+        case OP_MULTIPLY_RRR:
+            return register_store_instruction("OP_MULTIPLY_RRR", chunk, offset);
+
+        case OP_JUMP_IF_NOT_GREATER_RR:
+            return register_jump_instruction("OP_JUMP_IF_NOT_GREATER_RR", chunk, offset);
+
+        case OP_JUMP_IF_NOT_LESS_RR:
+            return register_jump_instruction("OP_JUMP_IF_NOT_LESS_RR", chunk, offset);
+
+        case OP_ADD_INT_INT:
+            return simple_instruction("OP_ADD_INT_INT", offset);
+
+        case OP_ADD_FLOAT_FLOAT:
+            return simple_instruction("OP_ADD_FLOAT_FLOAT", offset);
+
+        case OP_SUBTRACT_INT_INT:
+            return simple_instruction("OP_SUBTRACT_INT_INT", offset);
+
+        case OP_SUBTRACT_FLOAT_FLOAT:
+            return simple_instruction("OP_SUBTRACT_FLOAT_FLOAT", offset);
+
+        case OP_MULTIPLY_INT_INT:
+            return simple_instruction("OP_MULTIPLY_INT_INT", offset);
+
+        case OP_MULTIPLY_FLOAT_FLOAT:
+            return simple_instruction("OP_MULTIPLY_FLOAT_FLOAT", offset);
+
+        case OP_GREATER_INT_INT:
+            return simple_instruction("OP_GREATER_INT_INT", offset);
+
+        case OP_GREATER_FLOAT_FLOAT:
+            return simple_instruction("OP_GREATER_FLOAT_FLOAT", offset);
+
+        case OP_LESS_INT_INT:
+            return simple_instruction("OP_LESS_INT_INT", offset);
+
+        case OP_LESS_FLOAT_FLOAT:
+            return simple_instruction("OP_LESS_FLOAT_FLOAT", offset);
+
+        case OP_ADD_POLY:
+            return simple_instruction("OP_ADD_POLY", offset);
+
+        case OP_SUBTRACT_POLY:
+            return simple_instruction("OP_SUBTRACT_POLY", offset);
+
+        case OP_MULTIPLY_POLY:
+            return simple_instruction("OP_MULTIPLY_POLY", offset);
+
+        case OP_GREATER_POLY:
+            return simple_instruction("OP_GREATER_POLY", offset);
+
+        case OP_LESS_POLY:
+            return simple_instruction("OP_LESS_POLY", offset);
+
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
     }
-}
\ No newline at end of file
+}
+
+void dump_inline_caches(CodeChunk* chunk, const char* chunk_name) {
+    if (chunk->cache_count == 0) return;
+
+    printf("== inline caches: %s ==\n", chunk_name);
+    for (int i = 0; i < chunk->cache_count; i++) {
+        InlineCache* cache = &chunk->caches[i];
+        uint8_t constant_idx = chunk->chunk[cache->offset + 1];
+
+        printf("%04d %4d '", cache->offset, i);
+        print_value(chunk->const_pool.values[constant_idx]);
+        printf("' hits: %u, misses: %u\n", cache->hits, cache->misses);
+    }
+}
@@ -9,4 +9,7 @@ void disass_chunk(CodeChunk* chunk, const char* chunk_name);
 // Print the bytecode and return the offset of the next instruction in a chunk
 int disass_instruction(CodeChunk* chunk, int offset);
 
+// Print the hit/miss counters of the inline caches in a chunk
+void dump_inline_caches(CodeChunk* chunk, const char* chunk_name);
+
 #endif // !ICO_DEBUG_H
@@ -0,0 +1,337 @@
+// For sigaction() and getpid() with a strict C standard
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ico_heapdump.h"
+#include "ico_memory.h"
+#include "ico_object.h"
+#include "ico_vm.h"
+
+/* The heap dump walks the object graph from the same roots as the GC,
+but with a set of its own instead of the mark bits, which may be in
+use by an unfinished collection. It runs at safe points of the VM only
+(in a native function or at a loop, call or return), and never
+allocates with reallocate(), so that the GC can't run meanwhile. */
+
+//------------------------------
+//      STATIC FUNCTIONS
+//------------------------------
+
+// An open-addressing hash set of the objects already found
+typedef struct {
+    Obj** objs;
+    size_t capacity;    // Power of 2
+    size_t count;
+} ObjSet;
+
+// The state of a heap dump
+typedef struct {
+    FILE* file;
+    ObjSet found;           // Objects found so far
+    Obj** pending;          // Found objects that are yet to be written
+    size_t pending_count;
+    size_t pending_capacity;
+    bool first_item;        // No item written yet in the current JSON array
+} HeapDump;
+
+// Allocate with the system's allocator, which never triggers the GC
+static void* dump_alloc(void* ptr, size_t size) {
+    void* new_ptr = realloc(ptr, size);
+    if (new_ptr == NULL) {
+        fprintf(stderr, "Error: Out of memory.");
+        exit(1);
+    }
+    return new_ptr;
+}
+
+static size_t hash_obj(Obj* obj, size_t capacity) {
+    return (((uintptr_t)obj >> 4) * 11400714819323198485u) & (capacity - 1);
+}
+
+// Add an object to the set. Return false if it was there already.
+static bool obj_set_add(ObjSet* set, Obj* obj) {
+    if (2 * (set->count + 1) > set->capacity) {
+        // Grow the set and re-add all objects
+        ObjSet grown = {.capacity = set->capacity == 0 ? 1024 : set->capacity * 2};
+        grown.objs = (Obj**)dump_alloc(NULL, sizeof(Obj*) * grown.capacity);
+        memset(grown.objs, 0, sizeof(Obj*) * grown.capacity);
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->objs[i] != NULL) obj_set_add(&grown, set->objs[i]);
+        }
+        free(set->objs);
+        *set = grown;
+    }
+
+    size_t index = hash_obj(obj, set->capacity);
+    while (set->objs[index] != NULL) {
+        if (set->objs[index] == obj) return false;
+        index = (index + 1) & (set->capacity - 1);
+    }
+    set->objs[index] = obj;
+    set->count++;
+    return true;
+}
+
+// Remember a reachable object, to be written later if it is new
+static void find_object(HeapDump* dump, Obj* obj) {
+    if (obj == NULL || !obj_set_add(&dump->found, obj)) return;
+
+    if (dump->pending_count == dump->pending_capacity) {
+        dump->pending_capacity = GROW_CAPACITY(dump->pending_capacity);
+        dump->pending = (Obj**)dump_alloc(dump->pending, sizeof(Obj*) * dump->pending_capacity);
+    }
+    dump->pending[dump->pending_count++] = obj;
+}
+
+// Write a C string as a JSON string
+static void write_json_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (const char* c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') fprintf(file, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20) fprintf(file, "\\u%04x", *c);
+        else fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+// Write the separator before an item of a JSON array
+static void write_separator(HeapDump* dump) {
+    if (!dump->first_item) fputs(", ", dump->file);
+    dump->first_item = false;
+}
+
+static const char* function_name(ObjFunction* func) {
+    return func->name != NULL ? func->name->chars : "script";
+}
+
+// Write a root that refers to a value, if the value is an object
+static void write_root(HeapDump* dump, IcoValue val, const char* kind, const char* name) {
+    if (!IS_OBJ(val)) return;
+
+    write_separator(dump);
+    fprintf(dump->file, "\n    {\"id\": %llu, \"kind\": \"%s\", \"name\": ",
+        (unsigned long long)(uintptr_t)AS_OBJ(val), kind);
+    write_json_string(dump->file, name);
+    fputc('}', dump->file);
+    find_object(dump, AS_OBJ(val));
+}
+
+// Write the roots, in the order of mark_roots() in ico_memory.c.
+// The compiler has no roots of its own while the VM runs.
+static void write_roots(HeapDump* dump) {
+    // The VM stack, by the function whose frame holds the slot
+    for (int i = 0; i < vm.frame_count; i++) {
+        CallFrame* frame = &vm.frames[i];
+        IcoValue* end = i + 1 < vm.frame_count ? vm.frames[i + 1].base_ptr : vm.stack_top;
+        const char* name = function_name(frame->closure->function);
+        for (IcoValue* slot = frame->base_ptr; slot < end; slot++) {
+            write_root(dump, *slot, "stack", name);
+        }
+    }
+
+    // The closures of the call frames
+    for (int i = 0; i < vm.frame_count; i++) {
+        ObjClosure* closure = vm.frames[i].closure;
+        write_root(dump, OBJ_VAL(closure), "frame", function_name(closure->function));
+    }
+
+    // The open upvalues, whose values are still on the stack
+    for (ObjUpValue* u = vm.open_upvalues; u != NULL; u = u->next) {
+        write_root(dump, OBJ_VAL(u), "upvalue", "");
+    }
+
+    // The global variables and their names
+    Table* slots = &vm.global_slots;
+    for (uint32_t i = 0; i < slots->entry_count; i++) {
+        Entry* entry = &slots->entries[i];
+        if (!IS_STRING(entry->key)) continue;
+        const char* name = AS_C_STRING(entry->key);
+        write_root(dump, entry->key, "global name", name);
+        write_root(dump, vm.globals.values[AS_INT(entry->value)], "global", name);
+    }
+}
+
+// Write an edge from the current object to a value, if it is an object
+static void write_edge(HeapDump* dump, IcoValue val) {
+    if (!IS_OBJ(val)) return;
+
+    write_separator(dump);
+    fprintf(dump->file, "%llu", (unsigned long long)(uintptr_t)AS_OBJ(val));
+    find_object(dump, AS_OBJ(val));
+}
+
+static void write_array_edges(HeapDump* dump, ValueArray* array) {
+    for (int i = 0; i < array->size; i++) {
+        write_edge(dump, array->values[i]);
+    }
+}
+
+// Write the references of an object, as in blacken_one_object() in ico_memory.c
+static void write_edges(HeapDump* dump, Obj* obj) {
+    switch (obj->type) {
+        case OBJ_STRING:
+            break;
+
+        case OBJ_UPVALUE:
+            write_edge(dump, ((ObjUpValue*)obj)->closed);
+            break;
+
+        case OBJ_FUNCTION: {
+            ObjFunction* func = (ObjFunction*)obj;
+            if (func->name != NULL) write_edge(dump, OBJ_VAL(func->name));
+            write_array_edges(dump, &func->chunk.const_pool);
+            break;
+        }
+
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)obj;
+            write_edge(dump, OBJ_VAL(closure->function));
+            for (int i = 0; i < closure->upvalue_count; i++) {
+                if (closure->upvalues[i] != NULL) write_edge(dump, OBJ_VAL(closure->upvalues[i]));
+            }
+            break;
+        }
+
+        case OBJ_NATIVE:
+            write_edge(dump, OBJ_VAL(((ObjNative*)obj)->name));
+            break;
+
+        case OBJ_LIST:
+            write_array_edges(dump, &((ObjList*)obj)->array);
+            break;
+
+        case OBJ_TABLE: {
+            uint32_t iter = 0;
+            IcoValue key, value;
+            while (table_obj_next((ObjTable*)obj, &iter, &key, &value)) {
+                write_edge(dump, key);
+                write_edge(dump, value);
+            }
+            break;
+        }
+    }
+}
+
+// The shallow size of an object: its block and the arrays that it owns
+static size_t shallow_size(Obj* obj) {
+    size_t size = object_size(obj);
+
+    switch (obj->type) {
+        case OBJ_FUNCTION: {
+            CodeChunk* chunk = &((ObjFunction*)obj)->chunk;
+            size += chunk->capacity * (sizeof(uint8_t) + sizeof(int))
+                + chunk->const_pool.capacity * sizeof(IcoValue)
+                + chunk->cache_capacity * sizeof(InlineCache);
+            break;
+        }
+        case OBJ_CLOSURE:
+            size += ((ObjClosure*)obj)->upvalue_count * sizeof(ObjUpValue*);
+            break;
+        case OBJ_LIST:
+            size += ((ObjList*)obj)->array.capacity * sizeof(IcoValue);
+            break;
+        case OBJ_TABLE: {
+            size += ((ObjTable*)obj)->array.capacity * sizeof(IcoValue);
+            size += table_byte_size(&((ObjTable*)obj)->table);
+            size += ((ObjTable*)obj)->field_capacity * sizeof(IcoValue);
+            break;
+        }
+        default:
+            break;
+    }
+    return size;
+}
+
+// Write an object, and find the objects it refers to
+static void write_object(HeapDump* dump, Obj* obj) {
+    FILE* file = dump->file;
+    fprintf(file, "\n    {\"id\": %llu, \"type\": \"%s\", \"size\": %zu",
+        (unsigned long long)(uintptr_t)obj, obj_type_name(obj->type), shallow_size(obj));
+
+    // Name the functions, which helps to tell closures apart
+    ObjFunction* func = NULL;
+    if (obj->type == OBJ_FUNCTION) func = (ObjFunction*)obj;
+    else if (obj->type == OBJ_CLOSURE) func = ((ObjClosure*)obj)->function;
+    if (func != NULL) {
+        fputs(", \"name\": ", file);
+        write_json_string(file, function_name(func));
+    }
+    else if (obj->type == OBJ_NATIVE) {
+        fputs(", \"name\": ", file);
+        write_json_string(file, ((ObjNative*)obj)->name->chars);
+    }
+    else if (obj->type == OBJ_STRING) {
+        fprintf(file, ", \"length\": %d", ((ObjString*)obj)->length);
+    }
+
+    fputs(", \"edges\": [", file);
+    dump->first_item = true;
+    write_edges(dump, obj);
+    fputs("]}", file);
+}
+
+//------------------------------
+//      HEADER FUNCTIONS
+//------------------------------
+
+long dump_heap(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return -1;
+
+    HeapDump dump = {.file = file};
+    fputs("{\"format\": \"ico-heap\", \"version\": 1,\n  \"roots\": [", file);
+    dump.first_item = true;
+    write_roots(&dump);
+
+    // Depth-first walk of the objects found from the roots
+    fputs("],\n  \"objects\": [", file);
+    long object_count = 0;
+    while (dump.pending_count > 0) {
+        Obj* obj = dump.pending[--dump.pending_count];
+        if (object_count > 0) fputc(',', file);
+        write_object(&dump, obj);
+        object_count++;
+    }
+    fputs("]}\n", file);
+
+    free(dump.found.objs);
+    free(dump.pending);
+
+    bool failed = ferror(file);
+    if (fclose(file) != 0 || failed) return -1;
+    return object_count;
+}
+
+void dump_heap_on_signal() {
+    static int dump_count = 0;
+    char path[64];
+    snprintf(path, sizeof(path), "ico-heap-%ld-%d.json", (long)getpid(), ++dump_count);
+
+    long object_count = dump_heap(path);
+    if (object_count < 0) {
+        fprintf(stderr, "Could not write the heap dump \"%s\".\n", path);
+    }
+    else {
+        fprintf(stderr, "Heap dump: %ld objects written to \"%s\".\n", object_count, path);
+    }
+}
+
+// The handler of SIGUSR1. The dump itself can't run in a signal handler.
+static void request_heap_dump(int signal_number) {
+    vm.heap_dump_requested = 1;
+    vm.safepoint_requested = 1;
+}
+
+void install_heap_dump_signal() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_heap_dump;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+}
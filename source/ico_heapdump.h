@@ -0,0 +1,18 @@
+#ifndef ICO_HEAPDUMP_H
+#define ICO_HEAPDUMP_H
+
+#include "ico_common.h"
+
+// Write a JSON snapshot of every object reachable from the GC roots to
+// the file at path. Return the number of objects, or -1 if the file
+// can't be written. See notes/heap_dump.md for the format.
+long dump_heap(const char* path);
+
+// Dump the heap to "ico-heap-<pid>-<n>.json" in the current directory.
+// Used when the process gets SIGUSR1.
+void dump_heap_on_signal();
+
+// Let SIGUSR1 request a heap dump at the next safe point of the VM
+void install_heap_dump_signal();
+
+#endif // !ICO_HEAPDUMP_H
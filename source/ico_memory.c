@@ -1,11 +1,201 @@
+// For clock_gettime() and POSIX threads with a strict C standard
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "ico_memory.h"
 #include "ico_vm.h"
 #include "ico_compiler.h"
 
-#define GC_HEAP_GROW_FACTOR 2  // Arbitrarily chosen
+#ifdef USE_PARALLEL_MARK
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#endif
+
+#ifdef __SANITIZE_ADDRESS__
+// Let AddressSanitizer catch accesses to free slab slots
+#include <sanitizer/asan_interface.h>
+#define POISON_SLOT(ptr, size)      ASAN_POISON_MEMORY_REGION(ptr, size)
+#define UNPOISON_SLOT(ptr, size)    ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+#define POISON_SLOT(ptr, size)      ((void)(ptr), (void)(size))
+#define UNPOISON_SLOT(ptr, size)    ((void)(ptr), (void)(size))
+#endif
+
+#define GC_RUNAWAY_FACTOR 2         // Heap growth during a cycle that finishes it at once
+#define GC_NURSERY_SIZE (256 * 1024) // Bytes allocated between minor collections
+#define GC_STEP_SIZE (64 * 1024)    // Bytes allocated between incremental GC slices
+#define GC_CHECK_INTERVAL 64        // Objects processed between clock checks in a slice
+#define GC_SWEEP_STEP_SLABS 16     // Slabs swept per GC step without a pause target
+#define NO_DEADLINE UINT64_MAX
+
+// The slots of a slab start after its header
+#define SLAB_HEADER_SIZE \
+    ((sizeof(Slab) + SLAB_GRANULE - 1) / SLAB_GRANULE * SLAB_GRANULE)
+
+// The word and the bit of an object in one of the bitmaps of its slab
+#define BIT_WORD(bitmap, obj)   ((bitmap)[GRANULE_OF(obj) / 64])
+#define BIT_MASK(obj)           ((uint64_t)1 << (GRANULE_OF(obj) % 64))
+
+// The object of a large slab, and its size rounded up to the granule
+#define LARGE_OBJ(slab) ((Obj*)((char*)(slab) + SLAB_HEADER_SIZE))
+#define LARGE_SIZE(size) (((size) + SLAB_GRANULE - 1) / SLAB_GRANULE * SLAB_GRANULE)
+
+// All fixed-size Obj subtypes must fit in a size class
+_Static_assert(sizeof(ObjFunction) <= SLAB_MAX_SLOT,
+    "ObjFunction is too large for the slab allocator.");
+
+// A free slot, linked in the free list of its size class
+typedef struct FreeSlot {
+    struct FreeSlot* next;
+} FreeSlot;
+
+// The slots of one size
+typedef struct {
+    FreeSlot* free_list;    // Freed slots, which are reused first
+    char* bump;             // Next never-used slot in the newest slab
+    char* bump_end;         // End of the newest slab
+    Slab* slabs;            // All slabs of this size class
+    Slab* sweep_cursor;     // Next slab to be swept after a full marking
+    int slab_count;         // Number of slabs
+    size_t live_count;      // Number of slots in use
+} SizeClass;
+
+// The large slabs are kept in an extra size class after the others
+#define LARGE_CLASS SLAB_CLASS_COUNT
+
+static SizeClass size_classes[SLAB_CLASS_COUNT + 1];
+static int unswept_slabs = 0;   // Number of slabs to be swept in the current cycle
+
+#ifdef USE_PARALLEL_MARK
+#define GRAY_DEQUE_INIT_SIZE 1024   // Initial capacity of a gray deque (power of 2)
+#define MAX_MARK_THREADS 64
+
+// The circular buffer of a gray deque
+typedef struct GrayArray {
+    int64_t size;                   // Capacity (power of 2)
+    struct GrayArray* retired;      // Older, smaller buffer of the same deque
+    _Atomic(Obj*) objs[];
+} GrayArray;
+
+/* A work-stealing deque of gray objects (Chase-Lev). The owning marker
+pushes and takes at the bottom, the other markers steal from the top.
+Outgrown buffers are kept until the marking is done, as a thief may
+still be reading from them. */
+typedef struct {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(GrayArray*) array;
+} GrayDeque;
+
+// A marker thread of the parallel mark phase
+typedef struct {
+    GrayDeque deque;        // Gray objects to be blackened by this marker
+    pthread_t thread;       // Unused for marker 0, which is the main thread
+} Marker;
+
+static Marker* markers = NULL;      // The thread pool (NULL until first used)
+static int marker_count = 0;        // Number of markers, including the main thread
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static uint64_t pool_generation = 0;    // Incremented to start a parallel mark phase
+static int pool_busy = 0;               // Number of worker threads still marking
+static bool pool_exit = false;          // Set to shut the pool down
+
+static atomic_int idle_markers;         // For termination detection
+static bool parallel_marking = false;   // True during a parallel mark phase
+
+// The gray deque of the current marker thread (NULL outside of a parallel mark phase)
+static _Thread_local GrayDeque* local_gray = NULL;
+
+static void stop_markers();
+#endif
+
+// GC: Set the mark bit of an object. Return false if it was set already.
+static inline bool set_mark(Obj* obj) {
+    uint64_t* word = &BIT_WORD(SLAB_OF(obj)->mark_bits, obj);
+    uint64_t mask = BIT_MASK(obj);
+
+#ifdef USE_PARALLEL_MARK
+    // Several markers can reach the object at once, only one of them grays it
+    if (parallel_marking) {
+        _Atomic uint64_t* atomic_word = (_Atomic uint64_t*)word;
+        if (atomic_load_explicit(atomic_word, memory_order_relaxed) & mask) return false;
+        return !(atomic_fetch_or_explicit(atomic_word, mask, memory_order_relaxed) & mask);
+    }
+#endif
+
+    if (*word & mask) return false;
+    *word |= mask;
+    return true;
+}
+
+// GC: Clear the mark bit of an object
+static inline void clear_mark(Obj* obj) {
+    BIT_WORD(SLAB_OF(obj)->mark_bits, obj) &= ~BIT_MASK(obj);
+}
+
+static void start_gc_cycle();
+static void end_gc_cycle();
+static void gc_step();
+static void collect_incrementally();
+static void sweep_slab(Slab* slab);
+
+// Called when the heap outgrows vm.gc_options.max_heap. The limit is only
+// exceeded if a full collection can't bring the heap back under it. Then the
+// allocation still succeeds, and the VM raises a runtime error at its next
+// safe point (a loop, call or return).
+static void check_heap_limit() {
+    if (vm.heap_limit_exceeded) return;
+
+    collect_garbage();
+    if (vm.bytes_allocated > vm.gc_options.max_heap) {
+        vm.heap_limit_exceeded = true;
+        vm.safepoint_requested = 1;
+    }
+}
+
+// Account for a change of allocated bytes, and run the GC when needed.
+static void track_allocation(size_t old_size, size_t new_size) {
+    vm.bytes_allocated += new_size - old_size;
+
+    if (new_size > old_size) {
+        vm.nursery_bytes += new_size - old_size;
+        vm.gc_step_bytes += new_size - old_size;
+
+#ifdef DEBUG_STRESS_GC
+        // Stress testing GC: Run at every possible chance,
+        // alternating between minor and full collections (or
+        // slices of a full collection in incremental mode)
+        static bool stress_full = false;
+        stress_full = !stress_full;
+        if (!stress_full) collect_young_garbage();
+        else if (vm.gc_options.pause_target == 0) collect_garbage();
+        else if (vm.gc_phase == GC_IDLE) start_gc_cycle();
+        else gc_step();
+#endif
+        if (vm.bytes_allocated > vm.gc_options.max_heap) {
+            check_heap_limit();
+            return;
+        }
+
+        // Normal GC: Run a full collection (or a slice of it) when threshold
+        // reached, or a minor collection when the nursery is full
+        if (vm.gc_phase != GC_IDLE || vm.bytes_allocated > vm.next_gc_run) {
+            collect_incrementally();
+        }
+        else if (vm.nursery_bytes > GC_NURSERY_SIZE) {
+            collect_young_garbage();
+        }
+    }
+}
 
 /*
 * This function works as follows.
@@ -16,18 +206,7 @@
 * != 0        > old_cap   grow curent allocation
 */
 void* reallocate(void* ptr, size_t old_size, size_t new_size) {
-    vm.bytes_allocated += new_size - old_size;
-
-    if (new_size > old_size) {
-#ifdef DEBUG_STRESS_GC
-        // Stress testing GC: Run at every possible chance
-        collect_garbage();
-#endif
-        // Normal GC: Run when threshold reached
-        if (vm.bytes_allocated > vm.next_gc_run) {
-            collect_garbage();
-        }
-    }
+    track_allocation(old_size, new_size);
 
     if (new_size == 0) {
         free(ptr);
@@ -43,16 +222,240 @@ void* reallocate(void* ptr, size_t old_size, size_t new_size) {
     return new_ptr;
 }
 
+// Allocate a slab of "size" bytes and add it to the front of a size class.
+// New slabs are added before the sweep cursor, as they don't need a sweep.
+static Slab* new_slab(SizeClass* size_class, size_t size, bool is_large) {
+    // Unlike aligned_alloc(), posix_memalign() takes sizes that are
+    // not a multiple of the alignment, as large slabs have.
+    Slab* slab;
+    if (posix_memalign((void**)&slab, SLAB_SIZE, size) != 0) {
+        fprintf(stderr, "Error: Out of memory.");
+        exit(1);
+    }
+    slab->needs_sweep = false;
+    slab->is_large = is_large;
+    memset(slab->alloc_bits, 0, sizeof(slab->alloc_bits));
+    memset(slab->mark_bits, 0, sizeof(slab->mark_bits));
+
+    slab->prev = NULL;
+    slab->next = size_class->slabs;
+    if (slab->next != NULL) slab->next->prev = slab;
+    size_class->slabs = slab;
+    size_class->slab_count++;
+    return slab;
+}
+
+// Add a new slab to a size class, and start bump-allocating from it
+static void add_slab(SizeClass* size_class) {
+    Slab* slab = new_slab(size_class, SLAB_SIZE, false);
+    size_class->bump = (char*)slab + SLAB_HEADER_SIZE;
+    size_class->bump_end = (char*)slab + SLAB_SIZE;
+    POISON_SLOT(size_class->bump, size_class->bump_end - size_class->bump);
+}
+
+// Lazy sweeping: Sweep the slabs of a size class that the last full
+// marking left unswept, until one of them has a free slot.
+static void lazy_sweep(SizeClass* size_class) {
+    while (size_class->free_list == NULL && size_class->sweep_cursor != NULL) {
+        Slab* slab = size_class->sweep_cursor;
+        size_class->sweep_cursor = slab->next;
+        if (slab->needs_sweep) sweep_slab(slab);
+    }
+}
+
+// Allocate a large slab for an object larger than SLAB_MAX_SLOT
+static void* allocate_large_obj_memory(size_t size) {
+    SizeClass* size_class = &size_classes[LARGE_CLASS];
+    track_allocation(0, LARGE_SIZE(size));
+
+    Slab* slab = new_slab(size_class, SLAB_HEADER_SIZE + LARGE_SIZE(size), true);
+    Obj* obj = LARGE_OBJ(slab);
+    BIT_WORD(slab->alloc_bits, obj) |= BIT_MASK(obj);
+    size_class->live_count++;
+    return obj;
+}
+
+// Give a large slab back to the system
+static void free_large_obj_memory(void* ptr, size_t size) {
+    SizeClass* size_class = &size_classes[LARGE_CLASS];
+    track_allocation(LARGE_SIZE(size), 0);
+
+    Slab* slab = SLAB_OF(ptr);
+    if (slab->prev != NULL) slab->prev->next = slab->next;
+    else size_class->slabs = slab->next;
+    if (slab->next != NULL) slab->next->prev = slab->prev;
+    if (size_class->sweep_cursor == slab) size_class->sweep_cursor = slab->next;
+
+    size_class->slab_count--;
+    size_class->live_count--;
+    free(slab);
+}
+
+void* allocate_obj_memory(size_t size) {
+    if (size > SLAB_MAX_SLOT) return allocate_large_obj_memory(size);
+
+    int class_idx = (size - 1) / SLAB_GRANULE;
+    size_t slot_size = (class_idx + 1) * SLAB_GRANULE;
+    SizeClass* size_class = &size_classes[class_idx];
+
+    // Account for the whole slot (may run the GC, which frees slots)
+    track_allocation(0, slot_size);
+
+    // Out of free slots --> Sweep before asking for a new slab
+    if (size_class->free_list == NULL && size_class->bump + slot_size > size_class->bump_end) {
+        lazy_sweep(size_class);
+    }
+
+    void* slot;
+    if (size_class->free_list != NULL) { // Reuse a freed slot
+        slot = size_class->free_list;
+        UNPOISON_SLOT(slot, slot_size);
+        size_class->free_list = size_class->free_list->next;
+    }
+    else { // Take the next never-used slot
+        if (size_class->bump + slot_size > size_class->bump_end) {
+            add_slab(size_class);
+        }
+        slot = size_class->bump;
+        UNPOISON_SLOT(slot, slot_size);
+        size_class->bump += slot_size;
+    }
+
+    BIT_WORD(SLAB_OF(slot)->alloc_bits, slot) |= BIT_MASK(slot);
+    size_class->live_count++;
+    return slot;
+}
+
+void free_obj_memory(void* ptr, size_t size) {
+    if (size > SLAB_MAX_SLOT) {
+        free_large_obj_memory(ptr, size);
+        return;
+    }
+
+    int class_idx = (size - 1) / SLAB_GRANULE;
+    size_t slot_size = (class_idx + 1) * SLAB_GRANULE;
+    SizeClass* size_class = &size_classes[class_idx];
+    track_allocation(slot_size, 0);
+
+    Slab* slab = SLAB_OF(ptr);
+    BIT_WORD(slab->alloc_bits, ptr) &= ~BIT_MASK(ptr);
+    BIT_WORD(slab->mark_bits, ptr) &= ~BIT_MASK(ptr);
+
+    FreeSlot* slot = (FreeSlot*)ptr;
+    slot->next = size_class->free_list;
+    size_class->free_list = slot;
+    size_class->live_count--;
+    POISON_SLOT(slot, slot_size);
+}
+
+// Give all slabs back to the system. The large slabs are freed with their object.
+static void free_slabs() {
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        SizeClass* size_class = &size_classes[i];
+        Slab* slab = size_class->slabs;
+        while (slab != NULL) {
+            Slab* next = slab->next;
+            UNPOISON_SLOT(slab, SLAB_SIZE);
+            free(slab);
+            slab = next;
+        }
+        size_classes[i] = (SizeClass){0};
+    }
+    unswept_slabs = 0;
+}
+
+void get_slab_stats(int class_idx, SlabStats* stats) {
+    SizeClass* size_class = &size_classes[class_idx];
+    stats->slot_size = (class_idx + 1) * SLAB_GRANULE;
+    stats->slab_count = size_class->slab_count;
+    stats->capacity = size_class->slab_count * ((SLAB_SIZE - SLAB_HEADER_SIZE) / stats->slot_size);
+    stats->live_count = size_class->live_count;
+}
+
+void print_slab_stats() {
+    printf("== slab allocator ==\n");
+    printf("Slot  Slabs  Live slots  Capacity  Occupancy\n");
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        SlabStats stats;
+        get_slab_stats(i, &stats);
+        if (stats.slab_count == 0) continue;
+        printf("%4zu  %5d  %10zu  %8zu  %8.1f%%\n", stats.slot_size, stats.slab_count,
+            stats.live_count, stats.capacity, 100.0 * stats.live_count / stats.capacity);
+    }
+    printf("Large objects: %zu\n", size_classes[LARGE_CLASS].live_count);
+}
+
+size_t object_size(Obj* obj) {
+    switch (obj->type) {
+        case OBJ_STRING: return STRING_OBJ_SIZE(((ObjString*)obj)->length);
+        case OBJ_UPVALUE: return sizeof(ObjUpValue);
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_NATIVE: return sizeof(ObjNative);
+        case OBJ_CLOSURE: return sizeof(ObjClosure);
+        case OBJ_LIST: return sizeof(ObjList);
+        case OBJ_TABLE: return sizeof(ObjTable);
+    }
+    return 0;
+}
+
+#ifdef DEBUG_VERIFY_HEAP
+#define OBJ_TYPE_COUNT (OBJ_TABLE + 1)
+
+// Allocation and free totals of one object type
+typedef struct {
+    size_t alloc_count;
+    size_t alloc_bytes;
+    size_t free_count;
+    size_t free_bytes;
+} ObjTypeTotals;
+
+static ObjTypeTotals obj_type_totals[OBJ_TYPE_COUNT];
+
+void count_object_alloc(ObjType type, size_t size) {
+    obj_type_totals[type].alloc_count++;
+    obj_type_totals[type].alloc_bytes += size;
+}
+
+bool verify_heap() {
+    bool ok = vm.bytes_allocated == 0;
+
+    printf("== heap verification ==\n");
+    printf("Type      Allocated  Alloc bytes      Freed   Free bytes  Live  Live bytes\n");
+    for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+        ObjTypeTotals* totals = &obj_type_totals[i];
+        size_t live_count = totals->alloc_count - totals->free_count;
+        size_t live_bytes = totals->alloc_bytes - totals->free_bytes;
+        if (live_count != 0 || live_bytes != 0) ok = false;
+
+        printf("%-8s %10zu %12zu %10zu %12zu %5zu %11zu\n", obj_type_name((ObjType)i),
+            totals->alloc_count, totals->alloc_bytes,
+            totals->free_count, totals->free_bytes, live_count, live_bytes);
+    }
+    printf("Bytes still allocated: %zu\n", vm.bytes_allocated);
+
+    if (!ok) fprintf(stderr, "Heap verification failed: memory was not freed.\n");
+    return ok;
+}
+#endif // DEBUG_VERIFY_HEAP
+
 static void free_one_object(Obj* obj) {
 #ifdef DEBUG_LOG_GC
     printf("%p free type %d\n", (void*)obj, obj->type);
 #endif
 
+#ifdef DEBUG_VERIFY_HEAP
+    // The check keeps GCC's array bounds analysis quiet, as the type tag
+    // can't be proven to be in range at compile time
+    if ((unsigned)obj->type < OBJ_TYPE_COUNT) {
+        obj_type_totals[obj->type].free_count++;
+        obj_type_totals[obj->type].free_bytes += object_size(obj);
+    }
+#endif
+
     switch (obj->type) {
         case OBJ_STRING: {
             ObjString* obj_str = (ObjString*)obj;
-            FREE_ARRAY(char, obj_str->chars, obj_str->length);
-            FREE(ObjString, obj);
+            free_obj_memory(obj, STRING_OBJ_SIZE(obj_str->length));
             break;
         }
 
@@ -92,28 +495,133 @@ static void free_one_object(Obj* obj) {
         case OBJ_LIST: {
             ObjList* list = (ObjList*)obj;
             free_value_array(&list->array);
+            FREE(ObjList, obj);
             break;
         }
 
         case OBJ_TABLE: {
             ObjTable* table = (ObjTable*)obj;
+            free_value_array(&table->array);
             free_table(&table->table);
+            FREE_ARRAY(IcoValue, table->fields, table->field_capacity);
+            FREE(ObjTable, obj);
             break;
         }
     }
 }
 
-void free_objects() {
-    Obj* curr_obj = vm.allocated_objs;
+// The object in the slot of a slab at the passed bit of a bitmap word
+#define SLOT_AT(slab, word_idx, bit) \
+    ((Obj*)((char*)(slab) + ((word_idx) * 64 + (bit)) * SLAB_GRANULE))
+
+void for_each_object(void (*callback)(Obj* obj)) {
+    for (int i = 0; i <= LARGE_CLASS; i++) {
+        for (Slab* slab = size_classes[i].slabs; slab != NULL; slab = slab->next) {
+            for (int w = 0; w < SLAB_GRANULES / 64; w++) {
+                uint64_t in_use = slab->alloc_bits[w];
+                while (in_use != 0) {
+                    int bit = __builtin_ctzll(in_use);
+                    in_use &= in_use - 1;
+                    Obj* obj = SLOT_AT(slab, w, bit);
+
+                    // Skip the garbage that the lazy sweeping is yet to free
+                    if (slab->needs_sweep && obj->is_old
+                            && !((slab->mark_bits[w] >> bit) & 1)) continue;
+                    callback(obj);
+                }
+            }
+        }
+    }
+}
 
-    // Free the objects by traversing the Obj linked list
-    while (curr_obj != NULL) {
-        Obj* next_obj = curr_obj->next;
-        free_one_object(curr_obj);
-        curr_obj = next_obj;
+void free_objects() {
+    // Free every object in use, including the garbage that isn't swept yet
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++) {
+        for (Slab* slab = size_classes[i].slabs; slab != NULL; slab = slab->next) {
+            for (int w = 0; w < SLAB_GRANULES / 64; w++) {
+                uint64_t in_use = slab->alloc_bits[w];
+                while (in_use != 0) {
+                    int bit = __builtin_ctzll(in_use);
+                    in_use &= in_use - 1;
+                    free_one_object(SLOT_AT(slab, w, bit));
+                }
+            }
+        }
+    }
+    while (size_classes[LARGE_CLASS].slabs != NULL) {
+        free_one_object(LARGE_OBJ(size_classes[LARGE_CLASS].slabs));
     }
 
+    free_slabs();
+
+    free(vm.young_objs);
     free(vm.gray_stack);
+    free(vm.remembered);
+
+#ifdef USE_PARALLEL_MARK
+    stop_markers();
+#endif
+}
+
+void add_young_object(Obj* obj) {
+    if (vm.young_capacity < vm.young_count + 1) {
+        vm.young_capacity = GROW_CAPACITY(vm.young_capacity);
+        vm.young_objs = (Obj**)realloc(vm.young_objs,
+            sizeof(Obj*) * vm.young_capacity);
+        // Use system's realloc() so that this never triggers the GC
+
+        if (vm.young_objs == NULL) {
+            fprintf(stderr, "Error: Out of memory.");
+            exit(1);
+        }
+    }
+    vm.young_objs[vm.young_count++] = obj;
+}
+
+void free_newest_object(Obj* obj) {
+    vm.young_count--;
+    free_one_object(obj);
+}
+
+void remember_object(Obj* obj) {
+    if (obj->is_remembered) return;
+
+    if (vm.remembered_capacity < vm.remembered_count + 1) {
+        vm.remembered_capacity = GROW_CAPACITY(vm.remembered_capacity);
+        vm.remembered = (Obj**)realloc(vm.remembered,
+            sizeof(Obj*) * vm.remembered_capacity);
+        // Use system's realloc() so that a barrier never triggers the GC
+
+        if (vm.remembered == NULL) {
+            fprintf(stderr, "Error: Out of memory.");
+            exit(1);
+        }
+    }
+
+    obj->is_remembered = true;
+    vm.remembered[vm.remembered_count++] = obj;
+}
+
+// Empty the remembered set
+static void forget_remembered() {
+    for (int i = 0; i < vm.remembered_count; i++) {
+        vm.remembered[i]->is_remembered = false;
+    }
+    vm.remembered_count = 0;
+}
+
+// Microseconds from a monotonic clock, for the GC pause target and statistics
+static uint64_t gc_clock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+// Mark all values in a ValueArray
+static void mark_value_array(ValueArray* array) {
+    for (int i = 0; i < array->size; i++) {
+        mark_value(array->values[i]);
+    }
 }
 
 // GC function: Mark all root objects (for the marking phase of mark-sweep GC)
@@ -133,18 +641,56 @@ static void mark_roots() {
         mark_object((Obj*)u);
     }
 
-    // Mark all global variables
-    mark_table(&vm.globals);
+    // Mark all global variables and their names
+    mark_table(&vm.global_slots);
+    mark_value_array(&vm.globals);
 
     // Mark objects used by the compiler
     mark_compiler_roots();
 
+    // Mark the keys of the shapes of tables
+    mark_shapes();
+
     // Note that the table of interned strings is not a root!
 }
 
+#ifdef USE_PARALLEL_MARK
+static void gray_deque_push(GrayDeque* deque, Obj* obj);
+#endif
+
+// Add an object to the gray stack
+static void push_gray(Obj* obj) {
+#ifdef USE_PARALLEL_MARK
+    if (local_gray != NULL) {
+        gray_deque_push(local_gray, obj);
+        return;
+    }
+#endif
+
+    if (vm.gray_capacity < vm.gray_count + 1) {
+        vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
+        vm.gray_stack = (Obj**)realloc(vm.gray_stack,
+            sizeof(Obj**) * vm.gray_capacity);
+        // Use system's realloc() because we can't use Ico's reallocate()
+
+        // Check for allocation error
+        if (vm.gray_stack == NULL) {
+            fprintf(stderr, "Error: Out of memory.");
+            exit(1);
+        }
+    }
+    vm.gray_stack[vm.gray_count++] = obj;
+}
+
 void mark_object(Obj* obj) {
-    // Don't add null objects or gray/black objects
-    if (obj == NULL || obj->is_marked) return;
+    if (obj == NULL) return;
+
+    // A minor collection doesn't trace the old generation
+    if (vm.gc_minor && obj->is_old) return;
+
+    // Mark the object as gray (marked and added to gray stack) if the object
+    // type has references to other Objs. Don't add gray/black objects.
+    if (!set_mark(obj)) return;
 
 #ifdef DEBUG_LOG_GC
     printf("%p mark ", (void*)obj);
@@ -152,51 +698,33 @@ void mark_object(Obj* obj) {
     printf("\n");
 #endif
 
-    // Mark the object as gray (is_marked and added to gray stack)
-    // if the object type has references to other Objs.
-    obj->is_marked = true;
     switch (obj->type) {
         case OBJ_STRING:
             // These types don't have any reference --> Don't add to gray stack
             break;
 
         default:
-            if (vm.gray_capacity < vm.gray_count + 1) {
-                vm.gray_capacity = GROW_CAPACITY(vm.gray_capacity);
-                vm.gray_stack = (Obj**)realloc(vm.gray_stack,
-                    sizeof(Obj**) * vm.gray_capacity);
-                // Use system's realloc() because we can't use Ico's reallocate()
-
-                // Check for allocation error
-                if (vm.gray_stack == NULL) {
-                    fprintf(stderr, "Error: Out of memory.");
-                    exit(1);
-                }
-            }
-            vm.gray_stack[vm.gray_count++] = obj;
+            push_gray(obj);
             break;
     }
 }
 
+void regray_object(Obj* obj) {
+    if (obj->type != OBJ_STRING) push_gray(obj);
+}
+
 void mark_value(IcoValue val) {
     if (IS_OBJ(val)) mark_object(AS_OBJ(val));
 }
 
 void mark_table(Table* table) {
-    for (uint32_t i = 0; i < table->capacity; i++) {
+    for (uint32_t i = 0; i < table->entry_count; i++) {
         Entry* entry = &table->entries[i];
         mark_value(entry->key);
         mark_value(entry->value);
     }
 }
 
-// Mark all values in a ValueArray
-static void mark_value_array(ValueArray* array) {
-    for (int i = 0; i < array->size; i++) {
-        mark_value(array->values[i]);
-    }
-}
-
 // Trace the object references of one object and mark them,
 // then mark the original object black.
 static void blacken_one_object(Obj* obj) {
@@ -258,7 +786,16 @@ static void blacken_one_object(Obj* obj) {
 
         case OBJ_TABLE: {
             ObjTable* table = (ObjTable*)obj;
-            mark_table(&table->table);
+            mark_value_array(&table->array);
+            if (table->shape != NULL) {
+                // The keys are marked with the shapes
+                for (uint32_t i = 0; i < table->shape->field_count; i++) {
+                    mark_value(table->fields[i]);
+                }
+            }
+            else {
+                mark_table(&table->table);
+            }
             break;
         }
 
@@ -269,69 +806,549 @@ static void blacken_one_object(Obj* obj) {
     }
 }
 
+#ifdef USE_PARALLEL_MARK
+//---------------------------------------
+//          PARALLEL MARK PHASE
+//---------------------------------------
+
+static GrayArray* new_gray_array(int64_t size) {
+    GrayArray* array = (GrayArray*)malloc(sizeof(GrayArray) + sizeof(Obj*) * size);
+    if (array == NULL) {
+        fprintf(stderr, "Error: Out of memory.");
+        exit(1);
+    }
+    array->size = size;
+    array->retired = NULL;
+    return array;
+}
+
+// Push a gray object at the bottom of a deque (owner only)
+static void gray_deque_push(GrayDeque* deque, Obj* obj) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    GrayArray* array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+
+    // Full --> Copy to a buffer twice the size
+    if (bottom - top > array->size - 1) {
+        GrayArray* bigger = new_gray_array(array->size * 2);
+        for (int64_t i = top; i < bottom; i++) {
+            atomic_store_explicit(&bigger->objs[i & (bigger->size - 1)],
+                atomic_load_explicit(&array->objs[i & (array->size - 1)],
+                    memory_order_relaxed), memory_order_relaxed);
+        }
+        bigger->retired = array;
+        atomic_store_explicit(&deque->array, bigger, memory_order_release);
+        array = bigger;
+    }
+
+    atomic_store_explicit(&array->objs[bottom & (array->size - 1)], obj, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+// Take a gray object from the bottom of a deque (owner only).
+// Return NULL if the deque is empty.
+static Obj* gray_deque_take(GrayDeque* deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    GrayArray* array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) { // Empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    Obj* obj = atomic_load_explicit(&array->objs[bottom & (array->size - 1)], memory_order_relaxed);
+    if (top == bottom) {
+        // Last object --> Race against the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                memory_order_seq_cst, memory_order_relaxed)) {
+            obj = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return obj;
+}
+
+// Steal a gray object from the top of another marker's deque. Return NULL if
+// the deque is empty or if another marker took the object first.
+static Obj* gray_deque_steal(GrayDeque* deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) return NULL;
+
+    GrayArray* array = atomic_load_explicit(&deque->array, memory_order_acquire);
+    Obj* obj = atomic_load_explicit(&array->objs[top & (array->size - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return obj;
+}
+
+static bool gray_deque_is_empty(GrayDeque* deque) {
+    return atomic_load_explicit(&deque->top, memory_order_acquire)
+        >= atomic_load_explicit(&deque->bottom, memory_order_acquire);
+}
+
+// Free the outgrown buffers of a deque (when no marker is running)
+static void free_retired_gray_arrays(GrayDeque* deque) {
+    GrayArray* array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+    GrayArray* retired = array->retired;
+    array->retired = NULL;
+    while (retired != NULL) {
+        GrayArray* next = retired->retired;
+        free(retired);
+        retired = next;
+    }
+}
+
+/* The work of one marker: blacken the objects of its own deque, then steal
+from the others. A marker without work counts itself as idle. A marker only
+becomes idle with an empty deque, and only running markers fill deques, so
+once all markers are idle, the marking is complete. */
+static void mark_in_parallel(int marker_idx) {
+    GrayDeque* own = &markers[marker_idx].deque;
+    for (;;) {
+        Obj* obj;
+        while ((obj = gray_deque_take(own)) != NULL) {
+            blacken_one_object(obj);
+        }
+
+        // Out of work --> Try to steal from the other markers
+        for (int i = 1; i < marker_count && obj == NULL; i++) {
+            obj = gray_deque_steal(&markers[(marker_idx + i) % marker_count].deque);
+        }
+        if (obj != NULL) {
+            blacken_one_object(obj);
+            continue;
+        }
+
+        // Still no work --> Idle until some shows up or all markers are idle
+        atomic_fetch_add(&idle_markers, 1);
+        for (;;) {
+            if (atomic_load(&idle_markers) == marker_count) return;
+
+            bool has_work = false;
+            for (int i = 0; i < marker_count && !has_work; i++) {
+                has_work = !gray_deque_is_empty(&markers[i].deque);
+            }
+            if (has_work) {
+                atomic_fetch_sub(&idle_markers, 1);
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+// The loop of a worker thread of the pool
+static void* marker_main(void* arg) {
+    int marker_idx = (int)(intptr_t)arg;
+    local_gray = &markers[marker_idx].deque;
+
+    uint64_t seen_generation = 0;
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (pool_generation == seen_generation && !pool_exit) {
+            pthread_cond_wait(&pool_start, &pool_lock);
+        }
+        if (pool_exit) break;
+        seen_generation = pool_generation;
+        pthread_mutex_unlock(&pool_lock);
+
+        mark_in_parallel(marker_idx);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--pool_busy == 0) pthread_cond_signal(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+// Start the pool of marker threads. Marker 0 is the main thread.
+static void start_markers() {
+    marker_count = vm.gc_options.mark_threads;
+    if (marker_count > MAX_MARK_THREADS) marker_count = MAX_MARK_THREADS;
+
+    markers = (Marker*)malloc(sizeof(Marker) * marker_count);
+    if (markers == NULL) {
+        fprintf(stderr, "Error: Out of memory.");
+        exit(1);
+    }
+
+    for (int i = 0; i < marker_count; i++) {
+        atomic_init(&markers[i].deque.top, 0);
+        atomic_init(&markers[i].deque.bottom, 0);
+        atomic_init(&markers[i].deque.array, new_gray_array(GRAY_DEQUE_INIT_SIZE));
+    }
+
+    for (int i = 1; i < marker_count; i++) {
+        if (pthread_create(&markers[i].thread, NULL, marker_main, (void*)(intptr_t)i) != 0) {
+            fprintf(stderr, "Error: Could not start a GC marker thread.");
+            exit(1);
+        }
+    }
+}
+
+// Stop the pool of marker threads
+static void stop_markers() {
+    if (markers == NULL) return;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_exit = true;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = 0; i < marker_count; i++) {
+        if (i > 0) pthread_join(markers[i].thread, NULL);
+        free_retired_gray_arrays(&markers[i].deque);
+        free(atomic_load(&markers[i].deque.array));
+    }
+    free(markers);
+    markers = NULL;
+}
+
+/* Trace the object references like trace_references(), with all markers.
+The gray objects from the roots are dealt out to the markers, which then
+balance the work by stealing. The mutex of the pool orders all marks
+before the return, so the intern table cleanup (table_remove_white) and
+the sweeping that follow see every mark made by the worker threads. */
+static void trace_references_in_parallel() {
+    if (markers == NULL) start_markers();
+
+    for (int i = 0; i < vm.gray_count; i++) {
+        gray_deque_push(&markers[i % marker_count].deque, vm.gray_stack[i]);
+    }
+    vm.gray_count = 0;
+
+    atomic_store(&idle_markers, 0);
+    parallel_marking = true;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_busy = marker_count - 1;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_start);
+    pthread_mutex_unlock(&pool_lock);
+
+    local_gray = &markers[0].deque;
+    mark_in_parallel(0);
+    local_gray = NULL;
+
+    pthread_mutex_lock(&pool_lock);
+    while (pool_busy > 0) {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    parallel_marking = false;
+    for (int i = 0; i < marker_count; i++) {
+        free_retired_gray_arrays(&markers[i].deque);
+    }
+}
+#endif // USE_PARALLEL_MARK
+
 // Trace through all object references and mark the reachable objects.
 static void trace_references() {
+#ifdef USE_PARALLEL_MARK
+    // Only full collections of large heaps are worth the synchronization
+    if (vm.gc_options.mark_threads > 1 && !vm.gc_minor
+            && vm.bytes_allocated >= vm.gc_options.parallel_mark_heap) {
+        trace_references_in_parallel();
+        return;
+    }
+#endif
+
     while (vm.gray_count > 0) {
         Obj* obj = vm.gray_stack[--vm.gray_count];
         blacken_one_object(obj);
     }
 }
 
-// Free all white objects
-static void sweep() {
-    Obj* prev = NULL;
-    Obj* curr = vm.allocated_objs;
+// Blacken gray objects until the gray stack is empty or the
+// deadline has passed. Return true if the gray stack is empty.
+static bool mark_slice(uint64_t deadline) {
+    int work = 0;
+    while (vm.gray_count > 0) {
+        Obj* obj = vm.gray_stack[--vm.gray_count];
+        blacken_one_object(obj);
 
-    // Traverse the intrusive linked list of allocated objects
-    while (curr != NULL) {
-        if (curr->is_marked) { // Marked --> Don't remove --> Continue
-            curr->is_marked = false; // Reset for the next GC run
-            prev = curr;
-            curr = curr->next;
-        }
-        else { // Unmarked --> Remove from linked list then free
-            Obj* to_be_freed = curr;
+        if (++work % GC_CHECK_INTERVAL == 0 && gc_clock() >= deadline) return false;
+    }
+    return true;
+}
 
-            // Remove from linked list
-            curr = curr->next;
-            if (prev != NULL) {
-                prev->next = curr;
+/* Sweep a slab: free the old objects that the last full marking didn't
+reach, then clear all mark bits of the slab at once. Only the header is
+read, of the unmarked objects. Young objects are left to the minor
+collections. The cycle ends with the sweep of the last slab. */
+static void sweep_slab(Slab* slab) {
+    slab->needs_sweep = false;
+
+    if (slab->is_large) {
+        // Freeing the object frees the slab too
+        Obj* obj = LARGE_OBJ(slab);
+        if (is_obj_marked(obj)) clear_mark(obj);
+        else if (obj->is_old) free_one_object(obj);
+    }
+    else {
+        for (int w = 0; w < SLAB_GRANULES / 64; w++) {
+            uint64_t unmarked = slab->alloc_bits[w] & ~slab->mark_bits[w];
+            while (unmarked != 0) {
+                int bit = __builtin_ctzll(unmarked);
+                unmarked &= unmarked - 1;
+
+                Obj* obj = SLOT_AT(slab, w, bit);
+                if (obj->is_old) free_one_object(obj);
             }
-            else {
-                vm.allocated_objs = curr;
+        }
+        memset(slab->mark_bits, 0, sizeof(slab->mark_bits));
+    }
+
+    if (--unswept_slabs == 0) end_gc_cycle();
+}
+
+// Sweep the unswept slabs of all size classes, until the deadline
+// has passed or max_slabs slabs have been swept.
+static void sweep_slabs(uint64_t deadline, int max_slabs) {
+    for (int i = 0; i <= LARGE_CLASS && unswept_slabs > 0; i++) {
+        SizeClass* size_class = &size_classes[i];
+        while (size_class->sweep_cursor != NULL) {
+            Slab* slab = size_class->sweep_cursor;
+            size_class->sweep_cursor = slab->next;
+            if (!slab->needs_sweep) continue;
+
+            sweep_slab(slab);
+            if (--max_slabs == 0) return;
+            if (deadline != NO_DEADLINE && gc_clock() >= deadline) return;
+        }
+    }
+}
+
+// Free all white young objects, and promote the others to the old generation.
+static void sweep_young() {
+    for (int i = 0; i < vm.young_count; i++) {
+        Obj* obj = vm.young_objs[i];
+        if (is_obj_marked(obj)) { // Survivor --> Promote
+            obj->is_old = true;
+
+            // In a slab that is yet to be swept, the mark keeps the object
+            // alive. Otherwise, it is reset for the next marking.
+            if (!SLAB_OF(obj)->needs_sweep) clear_mark(obj);
+        }
+        else {
+            // A minor collection doesn't know which old strings are
+            // alive, so the dead young strings are uninterned one by one.
+            if (vm.gc_minor && obj->type == OBJ_STRING) {
+                table_delete(&vm.strings, OBJ_VAL(obj));
             }
+            free_one_object(obj);
+        }
+    }
+    vm.young_count = 0;
+}
+
+// True if the gray stack was emptied during the current marking phase
+static bool gray_drained = false;
+
+// Add the time since "start" to the pause statistics
+static void record_pause(uint64_t start) {
+    uint64_t pause = gc_clock() - start;
+    vm.gc_pause_count++;
+    vm.gc_pause_total += pause;
+    if (pause > vm.gc_pause_max) vm.gc_pause_max = pause;
+}
+
+// Start a full collection cycle by marking the roots
+static void start_gc_cycle() {
+#ifdef DEBUG_LOG_GC
+    printf("-- gc cycle begin\n");
+#endif
+
+    vm.gc_phase = GC_MARKING;
+    vm.gc_step_bytes = 0;
+    gray_drained = false;
+    mark_roots();
+}
+
+/* Finish the marking phase without interruption. The roots (the stacks,
+globals, and compiler objects) don't have a write barrier, so they are
+marked again, then everything left gray is traced. This also marks the
+objects allocated during the marking phase, which start out white. After
+that, the white strings are uninterned, the young generation is swept
+right away, and all slabs are flagged to be swept lazily: by the allocator
+when a size class runs out of free slots, and by the GC steps. */
+static void finish_marking() {
+    mark_roots();
+    trace_references();
+    table_remove_white(&vm.strings);
 
-            // Free
-            free_one_object(to_be_freed);
+    // Flag the slabs before the young survivors are promoted,
+    // so that these keep their marks until their slab is swept.
+    // The large slabs of young objects are left to sweep_young().
+    for (int i = 0; i <= LARGE_CLASS; i++) {
+        SizeClass* size_class = &size_classes[i];
+        size_class->sweep_cursor = size_class->slabs;
+        for (Slab* slab = size_class->slabs; slab != NULL; slab = slab->next) {
+            if (slab->is_large && !LARGE_OBJ(slab)->is_old) continue;
+            slab->needs_sweep = true;
+            unswept_slabs++;
         }
     }
+    sweep_young();
+
+    // All young objects are gone, so no old object can reference one
+    forget_remembered();
+    vm.nursery_bytes = 0;
+
+    vm.gc_phase = GC_SWEEPING;
+    if (unswept_slabs == 0) end_gc_cycle();
 }
 
-void collect_garbage() {
+// End a full collection cycle after the sweeping phase
+static void end_gc_cycle() {
+    vm.gc_phase = GC_IDLE;
+    vm.gc_cycle_count++;
+
+    // Update the next GC trigger threshold. A collection is due before the
+    // heap limit is reached, so that check_heap_limit() rarely has to run.
+    GCOptions* options = &vm.gc_options;
+    vm.next_gc_run = (size_t)(vm.bytes_allocated * options->grow_factor);
+    if (vm.next_gc_run < vm.bytes_allocated + options->min_interval) {
+        vm.next_gc_run = vm.bytes_allocated + options->min_interval;
+    }
+    if (vm.next_gc_run > options->max_heap && vm.bytes_allocated < options->max_heap) {
+        vm.next_gc_run = options->max_heap;
+    }
+
 #ifdef DEBUG_LOG_GC
-    printf("-- gc begin\n");
+    printf("-- gc cycle end\n");
+    printf("   %zu bytes allocated, next at %zu\n", vm.bytes_allocated, vm.next_gc_run);
+#endif
+}
+
+// Run a slice of the current collection cycle of at most about
+// vm.gc_options.pause_target microseconds.
+static void gc_step() {
+    uint64_t start = gc_clock();
+    uint64_t deadline = start + vm.gc_options.pause_target;
+
+    if (vm.gc_phase == GC_MARKING) {
+        // The atomic end of the marking phase gets its own slice. The write
+        // barrier may have added gray objects since then, which are few.
+        if (gray_drained) finish_marking();
+        else gray_drained = mark_slice(deadline);
+    }
+    else if (vm.gc_phase == GC_SWEEPING) {
+        // Without a pause target, a few slabs are swept on top of the lazy
+        // sweeping, so that the cycle ends before the next one is due.
+        if (vm.gc_options.pause_target > 0) sweep_slabs(deadline, INT_MAX);
+        else sweep_slabs(NO_DEADLINE, GC_SWEEP_STEP_SLABS);
+    }
+
+    record_pause(start);
+}
+
+// Run the rest of the current collection cycle without interruption
+static void finish_gc_cycle() {
+    if (vm.gc_phase == GC_MARKING) finish_marking();
+    if (vm.gc_phase == GC_SWEEPING) sweep_slabs(NO_DEADLINE, INT_MAX);
+}
+
+void collect_young_garbage() {
+    // Marking in progress --> The young objects belong to the current cycle
+    if (vm.gc_phase == GC_MARKING) return;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc begin\n");
     size_t before = vm.bytes_allocated;
 #endif
 
-    // Start by marking the roots
+    uint64_t start = gc_clock();
+    vm.gc_minor = true;
+
+    // Mark the roots. Old objects are skipped, so only young
+    // objects are marked and traced.
     mark_roots();
 
-    // Then trace the object references
+    // Old objects that got references to young objects are roots too
+    for (int i = 0; i < vm.remembered_count; i++) {
+        blacken_one_object(vm.remembered[i]);
+    }
+    forget_remembered();
+
     trace_references();
+    sweep_young();
+    vm.nursery_bytes = 0;
 
-    // Then remove white objects from the string interning
-    // table to avoid dangling pointers
-    table_remove_white(&vm.strings);
+    vm.gc_minor = false;
+    vm.gc_minor_count++;
+    record_pause(start);
+
+#ifdef DEBUG_LOG_GC
+    printf("-- minor gc end\n");
+    printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+        before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc_run);
+#endif
+}
+
+void collect_garbage() {
+#ifdef DEBUG_LOG_GC
+    printf("-- gc begin\n");
+    size_t before = vm.bytes_allocated;
+#endif
 
-    // Sweep (Free) all white objects
-    sweep();
+    uint64_t start = gc_clock();
 
-    // Update the next GC trigger threshold
-    vm.next_gc_run = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
+    // Objects that died during an unfinished cycle may have been marked
+    // already, so that cycle is finished first, then a new one is run.
+    finish_gc_cycle();
+    start_gc_cycle();
+    finish_gc_cycle();
+
+    record_pause(start);
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
     printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
         before - vm.bytes_allocated, before, vm.bytes_allocated, vm.next_gc_run);
 #endif
-}
\ No newline at end of file
+}
+
+/* Called by track_allocation() when a full collection is due or under way.
+In stop-the-world mode (no pause target), the whole heap is marked at once.
+Otherwise, a cycle is started, then advanced by a slice every GC_STEP_SIZE
+allocated bytes. In both modes, the sweeping is lazy. If the program
+allocates so fast that the heap doubles before the cycle ends, the rest
+of the cycle is run at once. */
+static void collect_incrementally() {
+    if (vm.gc_phase == GC_IDLE) {
+        uint64_t start = gc_clock();
+        start_gc_cycle();
+        if (vm.gc_options.pause_target == 0) finish_marking();
+        record_pause(start);
+    }
+    else if (vm.bytes_allocated > vm.next_gc_run * GC_RUNAWAY_FACTOR) {
+        uint64_t start = gc_clock();
+        finish_gc_cycle();
+        record_pause(start);
+    }
+    else if (vm.gc_step_bytes > GC_STEP_SIZE) {
+        vm.gc_step_bytes = 0;
+        gc_step();
+    }
+    else if (vm.gc_phase == GC_SWEEPING && vm.nursery_bytes > GC_NURSERY_SIZE) {
+        // Minor collections go on while the old generation is swept
+        collect_young_garbage();
+    }
+}
+
+void print_gc_stats() {
+    printf("GC cycles: %zu full, %zu minor\n", vm.gc_cycle_count, vm.gc_minor_count);
+    printf("GC pauses: %zu, total %.3f ms, max %.3f ms, mean %.3f ms\n",
+        vm.gc_pause_count, vm.gc_pause_total / 1000.0, vm.gc_pause_max / 1000.0,
+        vm.gc_pause_count > 0 ? vm.gc_pause_total / 1000.0 / vm.gc_pause_count : 0.0);
+}
@@ -4,6 +4,7 @@
 #include "ico_common.h"
 #include "ico_object.h"
 #include "ico_table.h"
+#include "ico_vm.h"
 
 // Return the new capacity when growing is required
 #define GROW_CAPACITY(cap) ((cap) < 8 ? 8 : (cap) * 2)
@@ -24,13 +25,83 @@ void* reallocate(void* ptr, size_t old_size, size_t new_size);
 #define ALLOCATE(type, count) \
     (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
-// Free a block pointed to by "ptr" of type "type"
-#define FREE(type, ptr) reallocate(ptr, sizeof(type), 0)
+// Free an Obj pointed to by "ptr" of the Obj subtype "type"
+#define FREE(type, ptr) free_obj_memory(ptr, sizeof(type))
 
+// Number of size classes of the slab allocator for Obj
+#define SLAB_CLASS_COUNT 16
+
+#define SLAB_SIZE (64 * 1024)   // Bytes per slab, which is also its alignment
+#define SLAB_GRANULE 16         // Slot sizes are multiples of this
+#define SLAB_GRANULES (SLAB_SIZE / SLAB_GRANULE)
+#define SLAB_MAX_SLOT (SLAB_CLASS_COUNT * SLAB_GRANULE) // Largest slot of a size class
+
+/* A slab (page) of the Obj allocator holds slots of one size class. Its
+header has a bitmap of the slots in use and a bitmap of the GC mark bits,
+with one bit per granule. Slabs are aligned to their size, so the slab
+and the bits of an object are found from its address. An object larger
+than SLAB_MAX_SLOT (a long string) gets a large slab of its own, which is
+only as long as needed, so its bits are found the same way. */
+typedef struct Slab {
+    struct Slab* next;                          // Next slab of the size class
+    struct Slab* prev;                          // Previous slab of the size class
+    bool needs_sweep;                           // Not swept since the last full marking
+    bool is_large;                              // Holds a single object larger than SLAB_MAX_SLOT
+    uint64_t alloc_bits[SLAB_GRANULES / 64];    // Slots in use
+    uint64_t mark_bits[SLAB_GRANULES / 64];     // GC: marked (gray or black) objects
+} Slab;
+
+// The slab holding an object, and the granule index of the object in the slab
+#define SLAB_OF(obj) ((Slab*)((uintptr_t)(obj) & ~(uintptr_t)(SLAB_SIZE - 1)))
+#define GRANULE_OF(obj) (((uintptr_t)(obj) & (SLAB_SIZE - 1)) / SLAB_GRANULE)
+
+// GC: Return true if the object is marked (gray or black)
+static inline bool is_obj_marked(Obj* obj) {
+    size_t granule = GRANULE_OF(obj);
+    return (SLAB_OF(obj)->mark_bits[granule / 64] >> (granule % 64)) & 1;
+}
+
+// Occupancy statistics of one size class of the slab allocator
+typedef struct {
+    size_t slot_size;   // Bytes per slot
+    int slab_count;     // Number of slabs
+    size_t capacity;    // Number of slots in all slabs
+    size_t live_count;  // Number of slots in use
+} SlabStats;
+
+// Allocate a block for an Obj from the slab allocator.
+// The GC counts the whole slot, which is "size" rounded up.
+void* allocate_obj_memory(size_t size);
+
+// Give the block of an Obj of the passed size back to the slab allocator
+void free_obj_memory(void* ptr, size_t size);
+
+// Size of the block of an object, as passed to allocate_obj_memory()
+size_t object_size(Obj* obj);
+
+// Get the statistics of the size class at index class_idx
+void get_slab_stats(int class_idx, SlabStats* stats);
+
+// Print the occupancy of all size classes in use
+void print_slab_stats();
+
+
+// Call "callback" for every object on the heap
+void for_each_object(void (*callback)(Obj* obj));
 
 // Free all remaining heap-allocated objects and data owned by the VM
 void free_objects();
 
+// GC function: Add a newly allocated object to the young generation
+void add_young_object(Obj* obj);
+
+// GC function: Free the most recently allocated object right away.
+// No other object may have been allocated since then.
+void free_newest_object(Obj* obj);
+
+// GC function: Add an old object to the remembered set
+void remember_object(Obj* obj);
+
 // GC function: Mark one Obj-type object as gray
 void mark_object(Obj* obj);
 
@@ -40,7 +111,48 @@ void mark_value(IcoValue val);
 // GC function: Mark all keys and all values in a hash table
 void mark_table(Table* table);
 
+// GC function: Add an already marked object to the gray stack again
+void regray_object(Obj* obj);
+
+/* GC write barrier: Call after storing "val" into the object "container".
+- Old objects that get a reference to a young object are remembered, so that
+minor collections can find the young object without tracing the old generation.
+- While an incremental collection is marking, a black (already traced) object
+must not get a reference to a white object, so that object is marked gray. */
+static inline void write_barrier(Obj* container, IcoValue val) {
+    if (!IS_OBJ(val)) return;
+    Obj* obj = AS_OBJ(val);
+    if (container->is_old && !obj->is_old) {
+        remember_object(container);
+    }
+    if (vm.gc_phase == GC_MARKING && is_obj_marked(container) && !is_obj_marked(obj)) {
+        mark_object(obj);
+    }
+}
+
+// GC write barrier for stores of many values at once (eg. building a list).
+static inline void write_barrier_all(Obj* container) {
+    if (container->is_old) remember_object(container);
+    if (vm.gc_phase == GC_MARKING && is_obj_marked(container)) regray_object(container);
+}
+
 // Collect all unreachable objects and free them (aka. the GC function)
 void collect_garbage();
 
+// Collect unreachable young objects only, and promote the survivors
+void collect_young_garbage();
+
+// Print the GC cycle counts and pause times
+void print_gc_stats();
+
+#ifdef DEBUG_VERIFY_HEAP
+// Count a new object of the passed type and size
+void count_object_alloc(ObjType type, size_t size);
+
+// Print the allocation and free totals per object type. Return false if
+// an object or a byte is still allocated, which is expected once the VM
+// has freed everything.
+bool verify_heap();
+#endif
+
 #endif // !ICO_MEMORY_H
@@ -1,4 +1,6 @@
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "ico_memory.h"
@@ -15,15 +17,19 @@
 // specific Obj subtype. Also set up metadata for memory management purpose.
 static Obj* allocate_object(size_t size, ObjType type) {
     // "size" depends on the specific Obj subtype
-    Obj* obj = (Obj*)reallocate(NULL, 0, size);
+    Obj* obj = (Obj*)allocate_obj_memory(size);
 
     obj->hash = 0; // No hash by default
     obj->type = type; // Set the type tag
-    obj->is_marked = false; // All objects start out as unmarked
+    obj->is_old = false; // All objects start out as young (and unmarked)
+    obj->is_remembered = false;
 
-    // Add to head of Obj linked list (for memory management)
-    obj->next = vm.allocated_objs;
-    vm.allocated_objs = obj;
+    // Add to the young objects (for memory management)
+    add_young_object(obj);
+
+#ifdef DEBUG_VERIFY_HEAP
+    count_object_alloc(type, size);
+#endif
 
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)obj, size, type);
@@ -36,13 +42,8 @@ static Obj* allocate_object(size_t size, ObjType type) {
 #define ALLOCATE_OBJ(type, type_enum) \
     (type*)allocate_object(sizeof(type), type_enum)
 
-// Allocate and create an ObjString with the passed content and length.
-// The passed char* (allocated block) is used as-is and owned by the
-// returned ObjString.
-static ObjString* allocate_str_obj(char* chars, int length, uint32_t hash) {
-    ObjString* obj_str = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-    obj_str->chars = chars;
-    obj_str->length = length;
+// Intern a new ObjString, whose content has been written
+static ObjString* intern_str_obj(ObjString* obj_str, uint32_t hash) {
     ((Obj*)obj_str)->hash = hash;
 
     // To prevent the ObjString from being sweeped by the GC
@@ -92,6 +93,155 @@ static void print_function_obj(ObjFunction* func) {
     printf("<fn %s()>", func->name->chars);
 }
 
+// Return true if a key can be a field of a shaped table: a string that
+// could be an identifier, as in the dot notation
+static bool is_field_key(IcoValue key) {
+    if (!IS_STRING(key)) return false;
+
+    ObjString* str = AS_STRING(key);
+    if (str->length == 0 || isdigit((unsigned char)str->chars[0])) return false;
+    for (int i = 0; i < str->length; i++) {
+        char c = str->chars[i];
+        if (!isalnum((unsigned char)c) && c != '_') return false;
+    }
+    return true;
+}
+
+// Move the entries of a shaped table into its hash table
+static void make_hash_table(ObjTable* table) {
+    // The table stays a valid shaped table while this allocates
+    table_reserve(&table->table, table->shape->field_count);
+
+    Shape* shape = table->shape;
+    for (uint32_t i = 0; i < shape->field_count; i++) {
+        table_set(&table->table, OBJ_VAL(shape->keys[i]), table->fields[i]);
+    }
+    FREE_ARRAY(IcoValue, table->fields, table->field_capacity);
+    table->fields = NULL;
+    table->field_capacity = 0;
+    table->shape = NULL;
+}
+
+// Append a value to the array part of a table, as the value of the key
+// array.size. The next int keys of the hash part then move to the array
+// part too, as long as they follow. Each value is appended before it is
+// deleted from the hash part, so that it stays in the table if the
+// append allocates.
+static void append_array(ObjTable* table, IcoValue value) {
+    append_value_array(&table->array, value);
+
+    IcoValue next;
+    while (table->shape == NULL && table->table.count > 0
+            && table_get(&table->table, INT_VAL(table->array.size), &next)) {
+        append_value_array(&table->array, next);
+        table_delete(&table->table, INT_VAL(table->array.size - 1));
+    }
+}
+
+// Grow the fields of a shaped table to hold at least "count" values
+static void reserve_fields(ObjTable* table, uint32_t count) {
+    if (count <= table->field_capacity) return;
+
+    uint32_t capacity = table->field_capacity < 4 ? 4 : table->field_capacity * 2;
+    if (capacity < count) capacity = count;
+    table->fields = GROW_ARRAY(IcoValue, table->fields, table->field_capacity, capacity);
+    table->field_capacity = capacity;
+}
+
+// A list or table, and its copy in deep_copy()
+typedef struct {
+    Obj* original;
+    Obj* copy;
+} CopyPair;
+
+/* The state of a deep copy: an identity map from the original lists and
+tables to their copies (open addressing), so that shared and cyclic
+structures are copied once, and the copies whose content is yet to be
+filled in. Both use the system's allocator, which never runs the GC. */
+typedef struct {
+    CopyPair* copies;
+    uint32_t capacity;      // Power of 2
+    uint32_t count;
+    CopyPair* pending;
+    int pending_count;
+    int pending_capacity;
+} DeepCopy;
+
+static void* copier_alloc(void* ptr, size_t size) {
+    void* new_ptr = realloc(ptr, size);
+    if (new_ptr == NULL) {
+        fprintf(stderr, "Error: Out of memory.");
+        exit(1);
+    }
+    return new_ptr;
+}
+
+static CopyPair* find_copy(CopyPair* copies, uint32_t capacity, Obj* original) {
+    uint32_t index = (uint32_t)(((uintptr_t)original >> 4) * 2654435761u) & (capacity - 1);
+    while (copies[index].original != NULL && copies[index].original != original) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &copies[index];
+}
+
+static void add_copy(DeepCopy* copier, Obj* original, Obj* copy) {
+    if (2 * (copier->count + 1) > copier->capacity) {
+        uint32_t capacity = copier->capacity == 0 ? 64 : copier->capacity * 2;
+        CopyPair* copies = (CopyPair*)copier_alloc(NULL, sizeof(CopyPair) * capacity);
+        memset(copies, 0, sizeof(CopyPair) * capacity);
+        for (uint32_t i = 0; i < copier->capacity; i++) {
+            if (copier->copies[i].original != NULL) {
+                *find_copy(copies, capacity, copier->copies[i].original) = copier->copies[i];
+            }
+        }
+        free(copier->copies);
+        copier->copies = copies;
+        copier->capacity = capacity;
+    }
+    *find_copy(copier->copies, copier->capacity, original) = (CopyPair){original, copy};
+    copier->count++;
+
+    if (copier->pending_count == copier->pending_capacity) {
+        copier->pending_capacity = GROW_CAPACITY(copier->pending_capacity);
+        copier->pending = (CopyPair*)copier_alloc(copier->pending,
+            sizeof(CopyPair) * copier->pending_capacity);
+    }
+    copier->pending[copier->pending_count++] = (CopyPair){original, copy};
+}
+
+// Return the copy of a value in a deep copy. A list seen for the first time
+// gets an empty copy, with room for the content of the original, and a
+// table gets a shallow copy, whose lists and tables are replaced later.
+static IcoValue copy_container(DeepCopy* copier, IcoValue value) {
+    if (!IS_LIST(value) && !IS_TABLE(value)) return value;
+
+    Obj* original = AS_OBJ(value);
+    if (copier->count > 0) {
+        CopyPair* pair = find_copy(copier->copies, copier->capacity, original);
+        if (pair->original != NULL) return OBJ_VAL(pair->copy);
+    }
+
+    Obj* copy;
+    if (IS_LIST(value)) {
+        ObjList* list = new_list_obj();
+        push(OBJ_VAL(list));
+        reserve_value_array(&list->array, AS_LIST(value)->array.size);
+        pop();
+        copy = (Obj*)list;
+    }
+    else {
+        ObjTable* table = new_table_obj();
+        push(OBJ_VAL(table));
+        table_obj_copy(table, AS_TABLE(value));
+        write_barrier_all((Obj*)table);
+        pop();
+        copy = (Obj*)table;
+    }
+
+    add_copy(copier, original, copy);
+    return OBJ_VAL(copy);
+}
+
 //------------------------------
 //      HEADER FUNCTIONS
 //------------------------------
@@ -104,58 +254,52 @@ ObjString* copy_and_create_str_obj(const char* source_str, int length) {
     ObjString* interned = table_find_string(&vm.strings, source_str, length, hash);
     if (interned != NULL) return interned;
 
-    // Allocate memory for the content of the ObjString,
-    // including the NULL terminator.
-    char* new_str = ALLOCATE(char, length + 1);
-
-    // Copy the string content and add the NULL terminator.
-    memcpy(new_str, source_str, length);
-    new_str[length] = '\0';
+    // Copy the string content right into the new ObjString
+    ObjString* obj_str = new_str_obj(length);
+    memcpy(obj_str->chars, source_str, length);
 
-    return allocate_str_obj(new_str, length, hash);
+    return intern_str_obj(obj_str, hash);
 }
 
-ObjString* take_own_and_create_str_obj(char* chars, int length) {
-    // This function is used for when the user creates new strings
-    // at runtime, such as by string concatenation.
+ObjString* new_str_obj(int length) {
+    ObjString* obj_str = (ObjString*)allocate_object(STRING_OBJ_SIZE(length), OBJ_STRING);
+    obj_str->length = length;
+    obj_str->chars[length] = '\0';
+    return obj_str;
+}
 
-    // Calculate the hash
-    uint32_t hash = hash_chars(chars, length);
+ObjString* finish_str_obj(ObjString* obj_str) {
+    uint32_t hash = hash_chars(obj_str->chars, obj_str->length);
 
     // Check for interned string
-    ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
+    ObjString* interned = table_find_string(&vm.strings, obj_str->chars, obj_str->length, hash);
     if (interned != NULL) {
-        // Found interned -> Free the current char array and use the interned one.
-        FREE_ARRAY(char, chars, length + 1);
+        // Found interned -> Give the new ObjString back and use the interned one.
+        free_newest_object((Obj*)obj_str);
         return interned;
     }
 
-    // Otherwise, keep and use the current char array
-    return allocate_str_obj(chars, length, hash);
+    return intern_str_obj(obj_str, hash);
 }
 
 ObjString* get_substring_obj(ObjString* str, int start, int end) {
     start = TRUE_INT_IDX(start, str->length);
     end = TRUE_INT_IDX(end, str->length);
-    int length;
-    char* chars = NULL;
-
-    if (end >= start) { // In-order substring
-        length = end - start + 1;
-        chars = ALLOCATE(char, length + 1); // +1 for the '\0'
-        memcpy(chars, str->chars + start, length);
-    }
-    else { // Reversed substring
-        length = start - end + 1;
-        chars = ALLOCATE(char, length + 1); // +1 for the '\0'
-        int i = 0;
-        for (char* p = str->chars + start; p >= str->chars + end; p--) {
-            chars[i++] = *p;
-        }
+
+    // In-order substring: the content is already in one piece, so an
+    // interned string is found without allocating.
+    if (end >= start) {
+        return copy_and_create_str_obj(str->chars + start, end - start + 1);
     }
 
-    chars[length] = '\0';
-    return take_own_and_create_str_obj(chars, length);
+    // Reversed substring
+    int length = start - end + 1;
+    ObjString* result = new_str_obj(length);
+    int i = 0;
+    for (char* p = str->chars + start; p >= str->chars + end; p--) {
+        result->chars[i++] = *p;
+    }
+    return finish_str_obj(result);
 }
 
 ObjUpValue* new_upvalue_obj(IcoValue* slot) {
@@ -215,6 +359,7 @@ ObjList* get_sublist_obj(ObjList* list, int start, int end) {
     start = TRUE_INT_IDX(start, list->array.size);
     end = TRUE_INT_IDX(end, list->array.size);
     ObjList* result = new_list_obj();
+    push(OBJ_VAL(result)); // Root the list while it grows
 
     if (end >= start) { // In-order sublist
         for (int i = start; i <= end; i++) {
@@ -227,81 +372,186 @@ ObjList* get_sublist_obj(ObjList* list, int start, int end) {
         }
     }
 
+    // The list may have been promoted while growing
+    write_barrier_all((Obj*)result);
+    pop();
     return result;
 }
 
 ObjTable* new_table_obj() {
     ObjTable* table = ALLOCATE_OBJ(ObjTable, OBJ_TABLE);
     // Don't hash table
+    init_value_array(&table->array);
     init_table(&table->table);
+    table->shape = empty_shape();
+    table->fields = NULL;
+    table->field_capacity = 0;
     table->seen = false;
     return table;
 }
 
+bool table_obj_get(ObjTable* table, IcoValue key, IcoValue* dest) {
+    if (table_obj_in_array(table, key)) {
+        *dest = table->array.values[AS_INT(key)];
+        return true;
+    }
+    if (table->shape == NULL) return table_get(&table->table, key, dest);
+
+    int slot = shape_find_slot(table->shape, key);
+    if (slot < 0) return false;
+    *dest = table->fields[slot];
+    return true;
+}
+
+bool table_obj_set(ObjTable* table, IcoValue key, IcoValue value) {
+    if (table_obj_in_array(table, key)) {
+        table->array.values[AS_INT(key)] = value;
+        return false;
+    }
+
+    // The key right after the array part is never in the hash part, as
+    // append_array() moves it
+    if (IS_INT(key) && AS_INT(key) == table->array.size) {
+        append_array(table, value);
+        return true;
+    }
+
+    if (table->shape != NULL) {
+        int slot = shape_find_slot(table->shape, key);
+        if (slot >= 0) {
+            table->fields[slot] = value;
+            return false;
+        }
+
+        // A new field moves the table to the next shape
+        if (is_field_key(key)) {
+            Shape* next = shape_add_key(table->shape, AS_STRING(key));
+            if (next != NULL) {
+                reserve_fields(table, next->field_count);
+                table->fields[next->field_count - 1] = value;
+                table->shape = next;
+                return true;
+            }
+        }
+        make_hash_table(table);
+    }
+    return table_set(&table->table, key, value);
+}
+
+bool table_obj_next(ObjTable* table, uint32_t* iter, IcoValue* key, IcoValue* value) {
+    uint32_t array_size = (uint32_t)table->array.size;
+    if (*iter < array_size) {
+        *key = INT_VAL(*iter);
+        *value = table->array.values[*iter];
+        (*iter)++;
+        return true;
+    }
+
+    // The other entries are numbered from the end of the array part
+    if (table->shape != NULL) {
+        uint32_t slot = *iter - array_size;
+        if (slot >= table->shape->field_count) return false;
+        *key = OBJ_VAL(table->shape->keys[slot]);
+        *value = table->fields[slot];
+        (*iter)++;
+        return true;
+    }
+
+    while (*iter - array_size < table->table.entry_count) {
+        Entry* entry = &table->table.entries[(*iter)++ - array_size];
+        if (!IS_NULL(entry->key)) {
+            *key = entry->key;
+            *value = entry->value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void table_obj_copy(ObjTable* table, ObjTable* original) {
+    // The values of the copy are still reachable from the original,
+    // so they are marked even if a collection runs meanwhile
+    reserve_value_array(&table->array, original->array.size);
+    for (int i = 0; i < original->array.size; i++) {
+        table->array.values[i] = original->array.values[i];
+    }
+    table->array.size = original->array.size;
+
+    if (original->shape != NULL) {
+        // The table stays valid while this allocates
+        uint32_t field_count = original->shape->field_count;
+        reserve_fields(table, field_count);
+        for (uint32_t i = 0; i < field_count; i++) table->fields[i] = original->fields[i];
+        table->shape = original->shape;
+    }
+    else {
+        table->shape = NULL; // Empty: there are no fields to move
+        table_copy(&original->table, &table->table);
+    }
+}
+
 IcoValue shallow_copy(IcoValue original) {
     if (IS_LIST(original)) {
         ObjList* li1 = AS_LIST(original);
         ObjList* li2 = new_list_obj();
+        push(OBJ_VAL(li2));
         for (int i = 0; i < li1->array.size; i++) {
             append_value_array(&li2->array, li1->array.values[i]);
         }
-        return OBJ_VAL(li2);
+        write_barrier_all((Obj*)li2);
+        return pop();
     }
     else if (IS_TABLE(original)) {
         ObjTable* t1 = AS_TABLE(original);
         ObjTable* t2 = new_table_obj();
-        table_add_all(&t1->table, &t2->table);
-        return OBJ_VAL(t2);
+        push(OBJ_VAL(t2));
+        table_obj_copy(t2, t1);
+        write_barrier_all((Obj*)t2);
+        return pop();
     }
     return original;
 }
 
 IcoValue deep_copy(IcoValue original) {
-    if (IS_LIST(original)) {
-        ObjList* li1 = AS_LIST(original);
-        if (li1->seen) goto DEEP_COPY_ERROR;
-
-        li1->seen = true;
-        ObjList* li2 = new_list_obj();
-
-        for (int i = 0; i < li1->array.size; i++) {
-            IcoValue value = deep_copy(li1->array.values[i]);
-            if (IS_ERROR(value)) {
-                li1->seen = false;
-                return value;
+    if (!IS_LIST(original) && !IS_TABLE(original)) return original;
+
+    DeepCopy copier = {0};
+    IcoValue result = copy_container(&copier, original);
+    push(result); // The other copies are reachable from this one
+
+    // Fill in the copies one by one. Each new copy is stored into its
+    // parent right away, before anything else is allocated.
+    while (copier.pending_count > 0) {
+        CopyPair pair = copier.pending[--copier.pending_count];
+
+        if (pair.original->type == OBJ_LIST) {
+            ValueArray* from = &((ObjList*)pair.original)->array;
+            ObjList* to = (ObjList*)pair.copy;
+            for (int i = 0; i < from->size; i++) {
+                IcoValue value = copy_container(&copier, from->values[i]);
+                append_value_array(&to->array, value); // Reserved: doesn't allocate
+                write_barrier((Obj*)to, value);
             }
-            append_value_array(&li2->array, value);
         }
-
-        li1->seen = false;
-        return OBJ_VAL(li2);
-    }
-    else if (IS_TABLE(original)) {
-        ObjTable* t1 = AS_TABLE(original);
-        if (t1->seen) goto DEEP_COPY_ERROR;
-
-        t1->seen = true;
-        ObjTable* t2 = new_table_obj();
-
-        for (uint32_t i = 0; i < t1->table.capacity; i++) {
-            Entry* entry = &t1->table.entries[i];
-            IcoValue value = deep_copy(entry->value);
-            if (IS_ERROR(value)) {
-                t1->seen = false;
-                return value;
-            }
-            if (!IS_NULL(entry->key)) {
-                table_set(&t2->table, entry->key, value);
+        else {
+            ObjTable* from = (ObjTable*)pair.original;
+            ObjTable* to = (ObjTable*)pair.copy;
+            uint32_t iter = 0;
+            IcoValue key, value;
+            while (table_obj_next(from, &iter, &key, &value)) {
+                // Keys are shared, and other values are already in the copy
+                if (!IS_LIST(value) && !IS_TABLE(value)) continue;
+
+                value = copy_container(&copier, value);
+                table_obj_set(to, key, value); // Existing key: doesn't allocate
+                write_barrier((Obj*)to, value);
             }
         }
-
-        t1->seen = false;
-        return OBJ_VAL(t2);
     }
-    return original;
 
-DEEP_COPY_ERROR:
-    return ERROR_VAL("Can't deep copy self-recursive structure.");
+    free(copier.copies);
+    free(copier.pending);
+    return pop();
 }
 
 /**********************
@@ -359,7 +609,7 @@ void print_object(IcoValue val) {
 
         case OBJ_TABLE: {
             ObjTable* table = AS_TABLE(val);
-            if (table->table.count == 0) {
+            if (table_obj_count(table) == 0) {
                 printf("{}");
             }
             else {
@@ -367,13 +617,13 @@ void print_object(IcoValue val) {
                     table->seen = true;
                     fputc('{', stdout);
                     uint32_t j = 1;
-                    for (uint32_t i = 0; i < table->table.capacity; i++) {
-                        if (!IS_NULL(table->table.entries[i].key)) {
-                            print_value(table->table.entries[i].key);
-                            printf(": ");
-                            print_value(table->table.entries[i].value);
-                            if (j++ < table->table.count) printf(", ");
-                        }
+                    uint32_t iter = 0;
+                    IcoValue key, value;
+                    while (table_obj_next(table, &iter, &key, &value)) {
+                        print_value(key);
+                        printf(": ");
+                        print_value(value);
+                        if (j++ < table_obj_count(table)) printf(", ");
                     }
                     fputc('}', stdout);
                     table->seen = false;
@@ -384,4 +634,17 @@ void print_object(IcoValue val) {
             }
         }
     }
-}
\ No newline at end of file
+}
+
+const char* obj_type_name(ObjType type) {
+    switch (type) {
+        case OBJ_STRING: return "string";
+        case OBJ_UPVALUE: return "upvalue";
+        case OBJ_FUNCTION: return "function";
+        case OBJ_NATIVE: return "native";
+        case OBJ_CLOSURE: return "closure";
+        case OBJ_LIST: return "list";
+        case OBJ_TABLE: return "table";
+    }
+    return "unknown";
+}
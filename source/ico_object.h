@@ -4,6 +4,7 @@
 #include "ico_common.h"
 #include "ico_value.h"
 #include "ico_chunk.h"
+#include "ico_shape.h"
 #include "ico_table.h"
 
 // Types of heap-allocated value
@@ -32,27 +33,32 @@ typedef enum {
 // The "struct Obj" is declared in ico_value.h and defined here.
 struct Obj {
     ObjType type;       // Type tag for the obj
-    bool is_marked;     // For GC marking phase
+    bool is_old;        // GC: true if the object survived a collection
+    bool is_remembered; // GC: true if in the remembered set
     uint32_t hash;      // For hash table
-    struct Obj* next;   // For GC sweeping phase
 };
+// The GC mark bits are kept in bitmaps on the side (see ico_memory.h).
 
 #ifdef C23_ENUM_FIXED_TYPE
 // Static checks (aka at compile time) for the sizes of some types
 _Static_assert( sizeof(ObjType) == sizeof(char),
     "C23 enum type is not supported, ObjType is not char. Please disable this flag.");
-_Static_assert( sizeof(Obj) == 16,
-    "C23 enum type is not supported, Obj is not 16 bytes. Please disable this flag.");
+_Static_assert( sizeof(Obj) == 8,
+    "C23 enum type is not supported, Obj is not 8 bytes. Please disable this flag.");
 #endif
 
 // length is to know the string length without walking the string.
 // chars will have a null terminator so that C library can work with it.
+// The chars are stored right after the header, in the same block.
 struct ObjString {
     Obj obj;        // Common obj tag
     int length;     // Length of the string
-    char* chars;    // Content of the string
+    char chars[];   // Content of the string
 };
 
+// Size of the block of an ObjString of the passed length
+#define STRING_OBJ_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
 // Runtime representation for upvalues
 typedef struct ObjUpValue {
     Obj obj;
@@ -97,10 +103,19 @@ typedef struct {
     bool seen;
 } ObjList;
 
-// Obj subtype for table
+// Obj subtype for table. The values of the int keys 0 to n - 1 are in the
+// array part, "array", indexed by key, as in Lua. A table whose other keys
+// are all identifier-like strings is a shaped table, with their values in
+// "fields" (see ico_shape.h). It becomes a hash table, with all its other
+// entries in "table", once it gets another key. Use the table_obj_*
+// functions for either kind.
 typedef struct {
     Obj obj;
+    Shape* shape;               // NULL for a hash table
+    IcoValue* fields;           // The values in the slots of the shape
+    uint32_t field_capacity;
     Table table;
+    ValueArray array;           // The values of the keys 0 to array.size - 1
     bool seen;
 } ObjTable;
 
@@ -139,9 +154,14 @@ static inline bool is_obj_type(IcoValue val, ObjType target_type) {
 // into a newly allocated block
 ObjString* copy_and_create_str_obj(const char* source_str, int length);
 
-// Create a ObjString by taking ownership of the passed
-// char* (which points to an already allocated block)
-ObjString* take_own_and_create_str_obj(char* chars, int length);
+// Allocate a ObjString of the passed length, for the caller to write its
+// content into. It must then be interned with finish_str_obj(), before
+// anything else is allocated.
+ObjString* new_str_obj(int length);
+
+// Intern a ObjString made by new_str_obj(). If an equal string is interned
+// already, the new one is freed and the interned one is returned.
+ObjString* finish_str_obj(ObjString* obj_str);
 
 // Get the substring from start to end (INCLUSIVE) of the string str.
 // If start > end, a reversed substring is created and returned.
@@ -171,15 +191,49 @@ ObjList* get_sublist_obj(ObjList* list, int start, int end);
 // Create a new ObjTable
 ObjTable* new_table_obj();
 
+// Get the value of a key in a table into "dest". Return false if the key
+// doesn't exist.
+bool table_obj_get(ObjTable* table, IcoValue key, IcoValue* dest);
+
+// Add or set an entry in a table. Return true if it is a new entry. The
+// key and the value must be rooted, as this may allocate.
+bool table_obj_set(ObjTable* table, IcoValue key, IcoValue value);
+
+// Return true if "key" is in the array part of a table
+static inline bool table_obj_in_array(ObjTable* table, IcoValue key) {
+    return IS_INT(key) && AS_INT(key) >= 0 && AS_INT(key) < table->array.size;
+}
+
+// Number of entries of a table
+static inline uint32_t table_obj_count(ObjTable* table) {
+    uint32_t count = table->shape != NULL ? table->shape->field_count : table->table.count;
+    return (uint32_t)table->array.size + count;
+}
+
+// Iterate the entries of a table: start with *iter = 0, and get the next
+// key and value while this returns true. The array part comes first, in
+// key order, then the other entries in insertion order. The table must
+// not be changed meanwhile.
+bool table_obj_next(ObjTable* table, uint32_t* iter, IcoValue* key, IcoValue* value);
+
+// Make an empty table a copy of "original", with the same kind (shaped
+// or hash) and layout, so that setting its keys again doesn't allocate.
+// The caller runs the write barrier.
+void table_obj_copy(ObjTable* table, ObjTable* original);
+
 // Return a shallow copy of an ObjList or ObjTable.
 // Just return the original for all other types.
 IcoValue shallow_copy(IcoValue original);
 
-// Return a deep copy of an ObjList or ObjTable.
-// Just return the original for all other types.
+// Return a deep copy of an ObjList or ObjTable. Shared lists and tables
+// are copied once, so the copy has the same shape, cycles included.
+// Table keys are not copied. Just return the original for all other types.
 IcoValue deep_copy(IcoValue original);
 
 // Print an Obj (which is an IcoValue)
 void print_object(IcoValue val);
 
+// Return the name of an Obj subtype, such as "list"
+const char* obj_type_name(ObjType type);
+
 #endif //!ICO_OBJECT_H
\ No newline at end of file
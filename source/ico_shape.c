@@ -0,0 +1,110 @@
+#include "ico_memory.h"
+#include "ico_object.h"
+#include "ico_shape.h"
+
+// All shapes, with the empty shape first. The array is used to mark
+// the keys and to free the shapes, without walking the tree.
+static Shape** shapes = NULL;
+static uint32_t shape_count = 0;
+static uint32_t shape_capacity = 0;
+
+//------------------------------
+//      STATIC FUNCTIONS
+//------------------------------
+
+// Allocate a shape, with room for the keys of its parent and one more.
+// Nothing refers to it yet, so a GC during the allocation doesn't see it.
+static Shape* new_shape(Shape* parent, ObjString* key) {
+    uint32_t field_count = parent == NULL ? 0 : parent->field_count + 1;
+    ObjString** keys = NULL;
+    if (field_count > 0) {
+        keys = ALLOCATE(ObjString*, field_count);
+        for (uint32_t i = 0; i < parent->field_count; i++) keys[i] = parent->keys[i];
+        keys[field_count - 1] = key;
+    }
+
+    Shape* shape = ALLOCATE(Shape, 1);
+    shape->parent = parent;
+    shape->key = key;
+    shape->field_count = field_count;
+    shape->keys = keys;
+    shape->transitions = NULL;
+    shape->transition_count = 0;
+    shape->transition_capacity = 0;
+    return shape;
+}
+
+// Add a shape to the array of all shapes
+static void register_shape(Shape* shape) {
+    if (shape_count == shape_capacity) {
+        uint32_t old_cap = shape_capacity;
+        shape_capacity = GROW_CAPACITY(old_cap);
+        shapes = GROW_ARRAY(Shape*, shapes, old_cap, shape_capacity);
+    }
+    shapes[shape_count++] = shape;
+}
+
+//------------------------------
+//      HEADER FUNCTIONS
+//------------------------------
+
+void init_shapes() {
+    register_shape(new_shape(NULL, NULL));
+}
+
+void free_shapes() {
+    for (uint32_t i = 0; i < shape_count; i++) {
+        Shape* shape = shapes[i];
+        FREE_ARRAY(ObjString*, shape->keys, shape->field_count);
+        FREE_ARRAY(Shape*, shape->transitions, shape->transition_capacity);
+        FREE_ARRAY(Shape, shape, 1);
+    }
+    FREE_ARRAY(Shape*, shapes, shape_capacity);
+    shapes = NULL;
+    shape_count = 0;
+    shape_capacity = 0;
+}
+
+Shape* empty_shape() {
+    return shapes[0];
+}
+
+int shape_find_slot(Shape* shape, IcoValue key) {
+    if (!IS_STRING(key)) return -1;
+
+    // Strings are interned, so keys are compared by address
+    ObjString* str = AS_STRING(key);
+    for (uint32_t i = 0; i < shape->field_count; i++) {
+        if (shape->keys[i] == str) return (int)i;
+    }
+    return -1;
+}
+
+Shape* shape_add_key(Shape* shape, ObjString* key) {
+    // Follow the transition if another table made it already
+    for (uint32_t i = 0; i < shape->transition_count; i++) {
+        if (shape->transitions[i]->key == key) return shape->transitions[i];
+    }
+
+    if (shape->field_count == SHAPE_MAX_FIELDS || shape_count == SHAPE_MAX_COUNT) return NULL;
+
+    // The key is rooted by the caller until the shape is registered,
+    // and marked with the other shape keys from then on
+    Shape* child = new_shape(shape, key);
+    register_shape(child);
+
+    if (shape->transition_count == shape->transition_capacity) {
+        uint32_t old_cap = shape->transition_capacity;
+        shape->transition_capacity = GROW_CAPACITY(old_cap);
+        shape->transitions = GROW_ARRAY(Shape*, shape->transitions,
+            old_cap, shape->transition_capacity);
+    }
+    shape->transitions[shape->transition_count++] = child;
+    return child;
+}
+
+void mark_shapes() {
+    for (uint32_t i = 0; i < shape_count; i++) {
+        if (shapes[i]->key != NULL) mark_object((Obj*)shapes[i]->key);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef ICO_SHAPE_H
+#define ICO_SHAPE_H
+
+#include "ico_common.h"
+#include "ico_value.h"
+
+// Tables with more fields than this become hash tables
+#define SHAPE_MAX_FIELDS 16
+
+// No more shapes are created once there are this many. The next tables
+// that would need a new shape become hash tables.
+#define SHAPE_MAX_COUNT 4096
+
+/* A shape (aka. hidden class) is the list of keys of a record-like table.
+Tables whose keys are all identifier-like strings share the shape of their
+keys, and only store one value per key, in the slot given by the shape.
+
+Shapes form a tree of transitions from the empty shape: adding a key to a
+table moves it to the child shape with that key, which is created once
+and shared by all tables that get the same keys in the same order.
+Shapes live as long as the VM, and keep their keys alive. */
+typedef struct Shape Shape;
+struct Shape {
+    Shape* parent;
+    ObjString* key;             // The key added to the parent (NULL for the empty shape)
+    uint32_t field_count;       // Number of keys, which is also the number of slots
+    ObjString** keys;           // The keys, in slot order
+    Shape** transitions;        // The child shapes
+    uint32_t transition_count;
+    uint32_t transition_capacity;
+};
+
+// Create the empty shape
+void init_shapes();
+
+// Free all shapes
+void free_shapes();
+
+// Return the shape of an empty table
+Shape* empty_shape();
+
+// Return the slot of a key in a shape, or -1 if the shape doesn't have it
+int shape_find_slot(Shape* shape, IcoValue key);
+
+// Return the shape with the keys of "shape" and then "key", which must be
+// a new key. Return NULL if the shape would pass the limits on shapes.
+Shape* shape_add_key(Shape* shape, ObjString* key);
+
+// GC function: Mark the keys of all shapes
+void mark_shapes();
+
+#endif // !ICO_SHAPE_H
@@ -1,180 +1,273 @@
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "ico_memory.h"
 #include "ico_table.h"
 #include "ico_value.h"
 #include "ico_object.h"
 
-// The maximum load factor of a table
+// The maximum load factor of a table, deleted entries included. The
+// dense array has room for this many entries per slot.
 #define TABLE_MAX_LOAD 0.75
 
-Entry absent_entry = {NULL_VAL, ERROR_VAL("Fatal: absent_entry should not be reachable")};
+// The share of holes from which a table is compacted, after deletes.
+// Lookups that miss probe past the tombstones left in their slots.
+#define TABLE_MAX_HOLES 0.125
+
+// The slots of a table are probed in groups of this many control bytes
+#define TABLE_GROUP_SIZE 16
+
+// The size of the control byte array of a table: one byte per slot,
+// and at least one full group for small tables
+#define TABLE_CTRL_SIZE(capacity) \
+    ((capacity) < TABLE_GROUP_SIZE ? TABLE_GROUP_SIZE : (capacity))
+
+/* The slots are a "Swiss table": they are split into groups of
+TABLE_GROUP_SIZE, and a separate array has one control byte per slot:
+
+- Empty: 0x80
+- Deleted (tombstone): 0xFE
+- Full: 0 to 0x7F, 7 bits (H2) of the key's hash
+
+A key goes into its home slot (hash modulo capacity) if it is free, as
+with linear probing, so that keys with close hashes such as ints stay
+close in memory, and most lookups only check the home slot. Otherwise,
+a lookup compares the whole group of the home slot (H1) with H2 at once
+(with SSE2), so only the entries whose H2 matches are loaded. It stops
+at the first group that has an empty slot, and otherwise visits the
+next groups with triangular steps, which reach every group.
+
+Tables smaller than a group have a full group of control bytes, with
+the bytes past the capacity always empty.
+
+The entries themselves are in a separate dense array, in insertion order,
+and a full slot holds the index of its entry, after the control bytes.
+New entries are appended, and deleted ones leave a hole. When the dense
+array is full, the table is compacted: the live entries move to the front
+and the slots are rebuilt from them, in a larger table if needed. Resizes
+only re-index the entries, and iterations only visit the dense array. */
+
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+// The first group of the probe sequence (before masking)
+#define H1(hash) ((hash) / TABLE_GROUP_SIZE)
+
+// The top bits of a multiplicative hash, which vary even between keys
+// whose hashes only differ in the low bits, the bits that H1 drops
+#define H2(hash) ((uint8_t)(((hash) * 2654435769u) >> 25))
 
 //------------------------------
 //      STATIC FUNCTIONS
 //------------------------------
 
-// Empty: key=null, value=null
-// Tombstone: key=null, value=true
-
-static Entry* find_int_entry(Entry* entries, uint32_t capacity, IcoValue vkey) {
-    // See find_obj_entry for algorithm explanation comments
-
-    uint32_t index = (vkey.as.ui32[0] ^ vkey.as.ui32[1]) & (capacity - 1);
-    long ikey = AS_INT(vkey);
-    Entry* tombstone = NULL;
-    for (;;) {
-        Entry* entry = entries + index;
-        IcoValue curr_key = entry->key;
-        if (IS_NULL(curr_key)) {
-            if (IS_NULL(entry->value)) { // Empty slot
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else { // Tombstone
-                if (tombstone == NULL) tombstone = entry;
-            }
-        }
-        else if (IS_INT(curr_key) && AS_INT(curr_key) == ikey) { // Found the key
-            return entry;
-        }
-        index = (index + 1) & (capacity - 1);
+// Return a bit mask of the slots of a group whose control byte is "byte"
+static inline uint32_t group_match(const uint8_t* group, uint8_t byte) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; i++) {
+        if (group[i] == byte) mask |= 1u << i;
     }
+    return mask;
+#endif
 }
 
-static Entry* find_float_entry(Entry* entries, uint32_t capacity, IcoValue vkey) {
-    // See find_obj_entry for algorithm explanation comments
-
-    uint32_t index = (vkey.as.ui32[0] ^ vkey.as.ui32[1]) & (capacity - 1);
-    double fkey = AS_FLOAT(vkey);
-    Entry* tombstone = NULL;
-    for (;;) {
-        Entry* entry = entries + index;
-        IcoValue curr_key = entry->key;
-        if (IS_NULL(curr_key)) {
-            if (IS_NULL(entry->value)) { // Empty slot
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else { // Tombstone
-                if (tombstone == NULL) tombstone = entry;
-            }
-        }
-        else if (IS_FLOAT(curr_key) && AS_FLOAT(curr_key) == fkey) { // Found the key
-            return entry;
-        }
-        index = (index + 1) & (capacity - 1);
+// Return a bit mask of the empty or deleted slots of a group,
+// which are the control bytes with the high bit set
+static inline uint32_t group_match_free(const uint8_t* group) {
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; i++) {
+        if (group[i] & 0x80) mask |= 1u << i;
     }
+    return mask;
+#endif
 }
 
-static Entry* find_bool_entry(Entry* entries, uint32_t capacity, bool vkey) {
-    // See find_obj_entry for algorithm explanation comments
-
-    uint32_t hash = vkey ? TRUE_HASH : FALSE_HASH;
-    uint32_t index = hash & (capacity - 1);
-    Entry* tombstone = NULL;
-    for (;;) {
-        Entry* entry = entries + index;
-        IcoValue curr_key = entry->key;
-        if (IS_NULL(curr_key)) {
-            if (IS_NULL(entry->value)) { // Empty slot
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else { // Tombstone
-                if (tombstone == NULL) tombstone = entry;
-            }
-        }
-        else if (IS_BOOL(curr_key) && AS_BOOL(curr_key) == vkey) { // Found the key
-            return entry;
-        }
-        index = (index + 1) & (capacity - 1);
+static inline uint32_t group_index_mask(uint32_t capacity) {
+    return capacity <= TABLE_GROUP_SIZE ? 0 : capacity / TABLE_GROUP_SIZE - 1;
+}
+
+// Fold the 64 bits of a number key into a 32-bit hash
+static inline uint32_t hash_bits(uint64_t bits) {
+    return (uint32_t)bits ^ (uint32_t)(bits >> 32);
+}
+
+// Return the hash of a key. Null and error keys are rejected
+// by the VM before they reach a table.
+static inline uint32_t hash_key(IcoValue key) {
+    switch (VAL_TYPE(key)) {
+        case VAL_BOOL: return AS_BOOL(key) ? TRUE_HASH : FALSE_HASH;
+        case VAL_INT: case VAL_FLOAT: return hash_bits(VAL_BITS(key));
+        case VAL_OBJ: return AS_OBJ(key)->hash;
+        case VAL_ERROR: case VAL_NULL: default: return 0;
     }
 }
 
-static Entry* find_obj_entry(Entry* entries, uint32_t capacity, Obj* target) {
-    // Calculate the supposed index from the hash
-    uint32_t index = target->hash & (capacity - 1);
+// Return true if a key found in a table is the target key.
+// Strings are interned, so objects are compared by address.
+static inline bool same_key(IcoValue key, IcoValue target) {
+    switch (VAL_TYPE(target)) {
+        case VAL_OBJ: return IS_OBJ(key) && AS_OBJ(key) == AS_OBJ(target);
+        case VAL_INT: return IS_INT(key) && AS_INT(key) == AS_INT(target);
+        case VAL_FLOAT: return IS_FLOAT(key) && AS_FLOAT(key) == AS_FLOAT(target);
+        case VAL_BOOL: return IS_BOOL(key) && AS_BOOL(key) == AS_BOOL(target);
+        case VAL_ERROR: case VAL_NULL: default: return false;
+    }
+}
 
-    Entry* tombstone = NULL;
+// The number of entries the dense array of a table has room for
+static inline uint32_t max_entries(uint32_t capacity) {
+    return (uint32_t)(capacity * TABLE_MAX_LOAD);
+}
 
-    // Linear probing to find the index where the entry belongs
-    for (;;) {
-        Entry* entry = entries + index;
-        IcoValue curr_key = entry->key;
+// The size of the entry indexes of the slots: the entries of a table of up
+// to 256 slots are indexed with one byte, and up to 65536 slots with two
+static inline uint32_t index_size(uint32_t capacity) {
+    return capacity <= 256 ? 1 : capacity <= 65536 ? 2 : 4;
+}
 
-        // Found an empty slot or a tombstone
-        if (IS_NULL(curr_key)) {
-            // IMPORTANT: to not break the probing sequence, we only return when
-            // we reach an EMPTY slot,not a tombstone. This guarantees that
-            // we searched pass all tombstones.
+// The size of the block with the control bytes and the entry indexes
+static inline size_t slot_block_size(uint32_t capacity) {
+    return TABLE_CTRL_SIZE(capacity) + (size_t)capacity * index_size(capacity);
+}
 
-            // The tombstone (instead of the empty slot) is returned
-            // to reuse the tombstone slot and save space.
+// Return the index of the entry of a full slot
+static inline uint32_t get_index(Table* table, uint32_t slot) {
+    const uint8_t* indexes = table->ctrl + TABLE_CTRL_SIZE(table->capacity);
+    switch (index_size(table->capacity)) {
+        case 1: return indexes[slot];
+        case 2: return ((const uint16_t*)indexes)[slot];
+        default: return ((const uint32_t*)indexes)[slot];
+    }
+}
 
-            if (IS_NULL(entry->value)) { // Empty slot
-                return tombstone != NULL ? tombstone : entry;
-            }
-            else { // Tombstone
-                if (tombstone == NULL) tombstone = entry;
-            }
-        }
-        else if (IS_OBJ(curr_key) && AS_OBJ(curr_key) == target) { // Found the key
+static inline void set_index(Table* table, uint32_t slot, uint32_t index) {
+    uint8_t* indexes = table->ctrl + TABLE_CTRL_SIZE(table->capacity);
+    switch (index_size(table->capacity)) {
+        case 1: indexes[slot] = (uint8_t)index; break;
+        case 2: ((uint16_t*)indexes)[slot] = (uint16_t)index; break;
+        default: ((uint32_t*)indexes)[slot] = index; break;
+    }
+}
+
+// Find the entry of a key and write its slot into "slot".
+// Return NULL if the key isn't in the table.
+static Entry* find_entry(Table* table, IcoValue key, uint32_t hash, uint32_t* slot) {
+    if (table->capacity == 0) return NULL;
+
+    // Most keys are in their home slot (see find_free_slot)
+    uint32_t home = hash & (table->capacity - 1);
+    if (table->ctrl[home] == H2(hash)) {
+        Entry* entry = &table->entries[get_index(table, home)];
+        if (same_key(entry->key, key)) {
+            *slot = home;
             return entry;
         }
+    }
+
+    uint32_t mask = group_index_mask(table->capacity);
+    uint32_t group = H1(hash) & mask;
+    for (uint32_t step = 1;; step++) {
+        const uint8_t* ctrl = table->ctrl + group * TABLE_GROUP_SIZE;
+
+        // Only the entries whose H2 matches are compared
+        for (uint32_t match = group_match(ctrl, H2(hash)); match != 0; match &= match - 1) {
+            uint32_t index = group * TABLE_GROUP_SIZE + __builtin_ctz(match);
+            Entry* entry = &table->entries[get_index(table, index)];
+            if (same_key(entry->key, key)) {
+                *slot = index;
+                return entry;
+            }
+        }
 
-        index = (index + 1) & (capacity - 1);
+        // An empty slot ends the probe sequence, as an insert would have used it
+        if (group_match(ctrl, CTRL_EMPTY) != 0) return NULL;
 
         // Infinite loop CAN'T happen thanks to the load factor being maintained.
+        group = (group + step) & mask;
     }
 }
 
-// The main find_entry function:
-// Find an entry slot for the new key in the backing array, and return a pointer
-// to that slot. Input is "entries" instead of the table so that newly allocated
-// entry array can be used. Return an empty slot if can't find target.
-// Return NULL if target key is invalid.
-static Entry* find_entry(Entry* entries, uint32_t capacity, IcoValue target) {
-    // Switch case based on key type
-    switch (target.type) {
-        case VAL_BOOL: return find_bool_entry(entries, capacity, AS_BOOL(target));
-        case VAL_INT: return find_int_entry(entries, capacity, target);
-        case VAL_FLOAT: return find_float_entry(entries, capacity, target);
-        case VAL_OBJ: return find_obj_entry(entries, capacity, AS_OBJ(target));
-
-        case VAL_ERROR: case VAL_NULL: default:
-            // Should be unreachable --> Check in VM when try to access with []
-            return &absent_entry;
+// Return the first empty or deleted slot in the probe sequence of a hash.
+// In the first group, that is the first one from the home slot of the hash
+// on, as with linear probing.
+static uint32_t find_free_slot(uint8_t* ctrl, uint32_t capacity, uint32_t hash) {
+    // The control bytes past the capacity of a small table are not slots
+    uint32_t slots = capacity < TABLE_GROUP_SIZE ? (1u << capacity) - 1 : 0xFFFF;
+
+    uint32_t mask = group_index_mask(capacity);
+    uint32_t group = H1(hash) & mask;
+    uint32_t free_slots = group_match_free(ctrl + group * TABLE_GROUP_SIZE) & slots;
+    uint32_t from_home = free_slots >> (hash & (TABLE_GROUP_SIZE - 1)) << (hash & (TABLE_GROUP_SIZE - 1));
+    if (from_home != 0) return group * TABLE_GROUP_SIZE + __builtin_ctz(from_home);
+
+    for (uint32_t step = 1;; step++) {
+        if (free_slots != 0) return group * TABLE_GROUP_SIZE + __builtin_ctz(free_slots);
+        group = (group + step) & mask;
+        free_slots = group_match_free(ctrl + group * TABLE_GROUP_SIZE) & slots;
     }
 }
 
-// Resize the table's backing array to the new capacity
-static void adjust_table_capacity(Table* table, uint32_t new_capacity) {
-    Entry* new_entries = ALLOCATE(Entry, new_capacity);
+// Empty the full slot of an entry, and leave a hole in the dense array.
+// The slot becomes a tombstone only if a lookup may have to probe past it:
+// if its group has an empty slot, every lookup stops there.
+static void delete_entry(Table* table, Entry* entry, uint32_t slot) {
+    const uint8_t* group = table->ctrl + (slot & ~(uint32_t)(TABLE_GROUP_SIZE - 1));
+    table->ctrl[slot] = group_match(group, CTRL_EMPTY) != 0 ? CTRL_EMPTY : CTRL_DELETED;
+    table->count--;
+    entry->key = NULL_VAL;
+    entry->value = NULL_VAL; // Don't keep the value alive
+}
 
-    // Initialize the new memory block, as C doesn't
-    // guarantee the allocated block is clean
-    for (uint32_t i = 0; i < new_capacity; i++) {
-        new_entries[i].key = NULL_VAL;
-        new_entries[i].value = NULL_VAL;
+// Move the live entries to the front of the dense array, in order, and
+// rebuild the slots from them, which drops the tombstones. This doesn't
+// allocate, so it can run during a garbage collection.
+static void compact_table(Table* table) {
+    Entry* entries = table->entries;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < table->entry_count; i++) {
+        if (!IS_NULL(entries[i].key)) entries[count++] = entries[i];
     }
-
-    // Re-inserting all existing elements.
-    // Recalculate count to exclude tombstones.
-    table->count = 0;
-    for (uint32_t i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
-        if (IS_NULL(entry->key)) continue;
-
-        Entry* dest = find_entry(new_entries, new_capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-
-        table->count++;
+    table->entry_count = count;
+
+    memset(table->ctrl, CTRL_EMPTY, TABLE_CTRL_SIZE(table->capacity));
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t hash = hash_key(entries[i].key);
+        uint32_t slot = find_free_slot(table->ctrl, table->capacity, hash);
+        table->ctrl[slot] = H2(hash);
+        set_index(table, slot, i);
     }
+}
 
-    // Free the old entry array
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+// Compact the table if too many of its entries are holes
+static void drop_holes(Table* table) {
+    if (table->entry_count - table->count > table->capacity * TABLE_MAX_HOLES) {
+        compact_table(table);
+    }
+}
 
-    table->entries = new_entries;
+// Resize the table to the new capacity. The dense array is reallocated
+// as is, and then compacted and re-indexed in place.
+static void adjust_table_capacity(Table* table, uint32_t new_capacity) {
+    // The table stays valid until both arrays are allocated, as the
+    // allocations may run the GC
+    uint8_t* new_ctrl = ALLOCATE(uint8_t, slot_block_size(new_capacity));
+    table->entries = GROW_ARRAY(Entry, table->entries,
+        max_entries(table->capacity), max_entries(new_capacity));
+
+    if (table->capacity > 0) FREE_ARRAY(uint8_t, table->ctrl, slot_block_size(table->capacity));
+    table->ctrl = new_ctrl;
     table->capacity = new_capacity;
+    compact_table(table);
 }
 
 //------------------------------
@@ -183,109 +276,145 @@ static void adjust_table_capacity(Table* table, uint32_t new_capacity) {
 
 void init_table(Table* table) {
     table->count = 0;
+    table->entry_count = 0;
     table->capacity = 0;
+    table->ctrl = NULL;
     table->entries = NULL;
 }
 
 void free_table(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    if (table->capacity > 0) FREE_ARRAY(uint8_t, table->ctrl, slot_block_size(table->capacity));
+    FREE_ARRAY(Entry, table->entries, max_entries(table->capacity));
     init_table(table);
 }
 
 bool table_get(Table* table, IcoValue key, IcoValue* dest) {
-    // For optimization and to not access a NULL entry array
-    if (table->count == 0) return false;
+    uint32_t slot;
+    Entry* entry = find_entry(table, key, hash_key(key), &slot);
+    if (entry == NULL) return false;
 
-    Entry* entry = find_entry(table->entries, table->capacity, key);
+    *dest = entry->value;
+    return true;
+}
 
-    // Not found
-    if (IS_NULL(entry->key)) return false;
+bool table_find_slot(Table* table, IcoValue key, uint32_t* slot) {
+    Entry* entry = find_entry(table, key, hash_key(key), slot);
+    if (entry == NULL) return false;
 
-    // Found
-    *dest = entry->value;
+    *slot = (uint32_t)(entry - table->entries);
     return true;
 }
 
 bool table_set(Table* table, IcoValue key, IcoValue value) {
-    // Check the load factor and grow the table as needed
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        uint32_t new_cap = GROW_CAPACITY(table->capacity);
-        adjust_table_capacity(table, new_cap);
+    uint32_t hash = hash_key(key);
+
+    // Existing key: only set the value
+    uint32_t slot;
+    Entry* entry = find_entry(table, key, hash, &slot);
+    if (entry != NULL) {
+        entry->value = value;
+        return false;
     }
 
-    // Find the index where the entry belongs
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-
-    // Check for new key
-    bool is_new_key = IS_NULL(entry->key);
+    // The dense array is full. If the live entries would fill at most
+    // half of it, compacting it makes enough room.
+    if (table->entry_count == max_entries(table->capacity)) {
+        if (table->count + 1 <= max_entries(table->capacity) / 2) {
+            compact_table(table);
+        }
+        else {
+            uint32_t new_cap = GROW_CAPACITY(table->capacity);
+            adjust_table_capacity(table, new_cap);
+        }
+    }
 
-    // Only increment count when inserting into an EMPTY slot
-    if (is_new_key && IS_NULL(entry->value)) table->count++;
+    slot = find_free_slot(table->ctrl, table->capacity, hash);
+    table->ctrl[slot] = H2(hash);
+    set_index(table, slot, table->entry_count);
 
-    // Setup the new entry
+    entry = &table->entries[table->entry_count++];
     entry->key = key;
     entry->value = value;
-
-    return is_new_key;
+    table->count++;
+    return true;
 }
 
 bool table_delete(Table* table, IcoValue key) {
-    // For optimization and to not access a NULL entry array
-    if (table->count == 0) return false;
-
-    // Find the entry
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    if (IS_NULL(entry->key)) return false; // Not found
+    uint32_t slot;
+    Entry* entry = find_entry(table, key, hash_key(key), &slot);
+    if (entry == NULL) return false;
 
-    // Found -> Place a tombstone in the entry to delete
-    entry->key = NULL_VAL;
-    entry->value = BOOL_VAL(true);
+    delete_entry(table, entry, slot);
+    drop_holes(table);
     return true;
 }
 
-void table_add_all(Table* from, Table* to) {
-    for (uint32_t i = 0; i < from->capacity; i++) {
-        Entry* entry = &from->entries[i];
-        if (!IS_NULL(entry->key)) {
-            table_set(to, entry->key, entry->value);
-        }
-    }
+void table_copy(Table* from, Table* to) {
+    if (from->count == 0) return;
+
+    // "to" stays a valid empty table while the arrays are allocated
+    uint8_t* ctrl = ALLOCATE(uint8_t, slot_block_size(from->capacity));
+    Entry* entries = ALLOCATE(Entry, max_entries(from->capacity));
+    memcpy(ctrl, from->ctrl, slot_block_size(from->capacity));
+    memcpy(entries, from->entries, sizeof(Entry) * from->entry_count);
+
+    free_table(to);
+    to->count = from->count;
+    to->entry_count = from->entry_count;
+    to->capacity = from->capacity;
+    to->ctrl = ctrl;
+    to->entries = entries;
 }
 
-ObjString* table_find_string(Table* table, const char* str, int length, uint32_t hash) {
-    if (table->count == 0) return NULL;
+void table_reserve(Table* table, uint32_t count) {
+    uint32_t capacity = GROW_CAPACITY(0);
+    while (count > max_entries(capacity)) capacity = GROW_CAPACITY(capacity);
+    if (capacity > table->capacity) adjust_table_capacity(table, capacity);
+}
 
-    uint32_t index = hash & (table->capacity - 1);
-    for (;;) {
-        Entry* entry = table->entries + index;
-        IcoValue curr_key = entry->key;
+size_t table_byte_size(Table* table) {
+    if (table->capacity == 0) return 0;
+    return slot_block_size(table->capacity) + max_entries(table->capacity) * sizeof(Entry);
+}
 
-        // Empty slot or tombstone
-        if (IS_NULL(curr_key)) {
-            // Stop if found an actual empty slot -> String not found
-            if (IS_NULL(entry->value)) return NULL;
-        }
-        // Slot with string -> Check for equality by comparing hash and length as
-        // quick checks, then verify with char-to-char comparison.
-        else if (IS_STRING(curr_key)) {
-            ObjString* str_key = AS_STRING(curr_key);
-            if (str_key->length == length && AS_OBJ(curr_key)->hash == hash
+ObjString* table_find_string(Table* table, const char* str, int length, uint32_t hash) {
+    if (table->capacity == 0) return NULL;
+
+    // The same probe sequence as find_entry(), but comparing the characters
+    uint32_t mask = group_index_mask(table->capacity);
+    uint32_t group = H1(hash) & mask;
+    for (uint32_t step = 1;; step++) {
+        const uint8_t* ctrl = table->ctrl + group * TABLE_GROUP_SIZE;
+
+        // Check for equality by comparing hash and length as quick
+        // checks, then verify with char-to-char comparison.
+        for (uint32_t match = group_match(ctrl, H2(hash)); match != 0; match &= match - 1) {
+            uint32_t index = group * TABLE_GROUP_SIZE + __builtin_ctz(match);
+            IcoValue key = table->entries[get_index(table, index)].key;
+            if (!IS_STRING(key)) continue;
+
+            ObjString* str_key = AS_STRING(key);
+            if (str_key->length == length && AS_OBJ(key)->hash == hash
                     && memcmp(str_key->chars, str, length) == 0) {
-                // printf("Found interned string %.*s\n", length, str);
                 return str_key; // Found the interned ObjString
             }
         }
 
-        index = (index + 1) & (table->capacity - 1);
+        // Found an empty slot -> String not found
+        if (group_match(ctrl, CTRL_EMPTY) != 0) return NULL;
+        group = (group + step) & mask;
     }
 }
 
 void table_remove_white(Table* table) {
-    for (uint32_t i = 0; i < table->capacity; i++) {
+    for (uint32_t i = 0; i < table->entry_count; i++) {
         Entry* entry = &table->entries[i];
-        if (IS_OBJ(entry->key) && !AS_OBJ(entry->key)->is_marked) {
-            entry->key = NULL_VAL;
-            entry->value = BOOL_VAL(true);
+        if (IS_OBJ(entry->key) && !is_obj_marked(AS_OBJ(entry->key))) {
+            // The unmarked object isn't freed yet, so its hash can be read
+            uint32_t slot;
+            find_entry(table, entry->key, hash_key(entry->key), &slot);
+            delete_entry(table, entry, slot);
         }
     }
-}
\ No newline at end of file
+    drop_holes(table);
+}
@@ -10,11 +10,18 @@ typedef struct {
     IcoValue value;
 } Entry;
 
-// The struct for the hash table
+/* The struct for the hash table, laid out as a compact dict: the entries
+are in a dense array, in insertion order, and each slot only holds the
+index of its entry. The slots have a control byte, which tells whether
+they are empty, deleted or full (see ico_table.c), and an index of 1, 2
+or 4 bytes depending on the capacity. A deleted entry stays in the dense
+array as a hole, with a null key, until the table is compacted. */
 typedef struct {
-    uint32_t count;
-    uint32_t capacity;
-    Entry* entries;
+    uint32_t count;         // Number of entries, without the holes
+    uint32_t entry_count;   // Number of used entries in the dense array
+    uint32_t capacity;      // Number of slots, a power of 2
+    uint8_t* ctrl;          // The control bytes, then the entry indexes
+    Entry* entries;         // The dense array, with room for 3/4 of the capacity
 } Table;
 
 // Initialize the passed hash table
@@ -28,6 +35,10 @@ void free_table(Table* table);
 // return false.
 bool table_get(Table* table, IcoValue key, IcoValue* dest);
 
+// Find the entry with the passed key and write its index in the
+// entries array into "slot". Return false if the key doesn't exist.
+bool table_find_slot(Table* table, IcoValue key, uint32_t* slot);
+
 // Add or set an entry in the table. Return true if it
 // is a new entry, and false if it is an existing entry.
 bool table_set(Table* table, IcoValue key, IcoValue value);
@@ -36,8 +47,15 @@ bool table_set(Table* table, IcoValue key, IcoValue value);
 // return true if successful.
 bool table_delete(Table* table, IcoValue key);
 
-// Copy all entries from one table to another
-void table_add_all(Table* from, Table* to);
+// Make the empty table "to" a copy of "from". The slots and entries are
+// copied as they are, without rehashing the keys.
+void table_copy(Table* from, Table* to);
+
+// Grow the table so that "count" entries fit without growing again
+void table_reserve(Table* table, uint32_t count);
+
+// Return the number of bytes allocated for the arrays of a table
+size_t table_byte_size(Table* table);
 
 // Find a raw C string in the hash table. This function is
 // used for string interning in the interpreter.
@@ -23,13 +23,19 @@ void append_value_array(ValueArray* val_arr, IcoValue val) {
     val_arr->size++;
 }
 
+void reserve_value_array(ValueArray* val_arr, int capacity) {
+    if (capacity <= val_arr->capacity) return;
+    val_arr->values = GROW_ARRAY(IcoValue, val_arr->values, val_arr->capacity, capacity);
+    val_arr->capacity = capacity;
+}
+
 void free_value_array(ValueArray* val_arr) {
     FREE_ARRAY(IcoValue, val_arr->values, val_arr->capacity);
     init_value_array(val_arr);
 }
 
 void print_value(IcoValue val) {
-    switch (val.type) {
+    switch (VAL_TYPE(val)) {
         case VAL_BOOL:
             printf(AS_BOOL(val) ? ":)" : ":(");
             break;
@@ -59,6 +65,13 @@ void print_value(IcoValue val) {
 }
 
 bool values_equal(IcoValue b, IcoValue a) {
+#ifdef NAN_BOXING
+    // Floats need a real comparison (NaN != NaN, 0.0 == -0.0).
+    // Every other type is equal if and only if the bits are equal,
+    // except for errors, which are always not equal.
+    if (IS_FLOAT(a) && IS_FLOAT(b)) return AS_FLOAT(a) == AS_FLOAT(b);
+    return a == b && !IS_ERROR(a);
+#else
     // Check for same type first
     if (a.type != b.type) {
         return false;
@@ -79,4 +92,5 @@ bool values_equal(IcoValue b, IcoValue a) {
         case VAL_ERROR:     // Always not equal
         default:            return false; // Unreachable
     }
+#endif
 }
\ No newline at end of file
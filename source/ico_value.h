@@ -1,6 +1,8 @@
 #ifndef ICO_VALUE_H
 #define ICO_VALUE_H
 
+#include <limits.h>
+
 #include "ico_common.h"
 
 // The parent type for all heap-allocated types. The "struct Obj" is
@@ -20,6 +22,99 @@ typedef enum : int {
     VAL_ERROR,  // Special value type for error, can't be created by users.
 } ValueType;
 
+#ifdef NAN_BOXING
+/* NaN-boxing: every value is packed into a single 64-bit word.
+- A float is stored as-is. Any double that is not one of our quiet NaNs
+  (including the NaN produced by arithmetic) is a float.
+- All other types use a quiet NaN (QNAN), with the sign bit and the
+  tag bit 48 to tell them apart, and the lower 48 bits as the payload:
+
+    sign  bit 48  payload
+    1     0       Obj* pointer            -> VAL_OBJ
+    1     1       char* error message     -> VAL_ERROR
+    0     1       48-bit signed int       -> VAL_INT
+    0     0       1: null, 2: false, 3: true
+
+Note that ints are 48-bit (instead of 64-bit) in this mode. */
+typedef uint64_t IcoValue;
+
+#define SIGN_BIT        ((uint64_t)0x8000000000000000)
+#define QNAN            ((uint64_t)0x7ffc000000000000)
+#define TAG_INT         ((uint64_t)0x0001000000000000)
+#define PAYLOAD_MASK    ((uint64_t)0x0000ffffffffffff)
+
+// The bits that identify the type of a boxed (non-float) value
+#define BOX_TYPE_MASK   (SIGN_BIT | QNAN | TAG_INT)
+
+#define NULL_BITS       (QNAN | 1)
+#define FALSE_BITS      (QNAN | 2)
+#define TRUE_BITS       (QNAN | 3)
+#define INT_BITS        (QNAN | TAG_INT)
+#define OBJ_BITS        (SIGN_BIT | QNAN)
+#define ERROR_BITS      (SIGN_BIT | QNAN | TAG_INT)
+
+// We always want IcoValue to be exactly 8 bytes in this mode
+_Static_assert( sizeof(double) == sizeof(IcoValue),
+    "NaN-boxing requires 64-bit doubles. Please disable this flag.");
+
+// Reinterpret the bits of a double as an IcoValue
+static inline IcoValue float_to_value(double num) {
+    union { double num; uint64_t bits; } u = {.num = num};
+    return u.bits;
+}
+
+// Reinterpret the bits of an IcoValue as a double
+static inline double value_to_float(IcoValue val) {
+    union { uint64_t bits; double num; } u = {.bits = val};
+    return u.num;
+}
+
+// Macros to convert native C values to Ico Value
+#define BOOL_VAL(b)     ((IcoValue)((b) ? TRUE_BITS : FALSE_BITS))
+#define NULL_VAL        ((IcoValue)NULL_BITS)
+#define INT_VAL(i)      ((IcoValue)(INT_BITS | ((uint64_t)(i) & PAYLOAD_MASK)))
+#define FLOAT_VAL(f)    float_to_value(f)
+#define OBJ_VAL(o)      ((IcoValue)(OBJ_BITS | (uint64_t)(uintptr_t)(o)))
+#define ERROR_VAL(s)    ((IcoValue)(ERROR_BITS | (uint64_t)(uintptr_t)(s)))
+
+// The range of the ints that fit in the 48-bit payload
+#define INT_VAL_MAX     (((long)1 << 47) - 1)
+#define INT_VAL_MIN     (-((long)1 << 47))
+
+// Macros to convert an Ico Value to a C-native value.
+// AS_INT shifts left then right to sign-extend the 48-bit payload.
+#define AS_BOOL(val)    ((val) == TRUE_BITS)
+#define AS_INT(val)     ((long)((int64_t)((val) << 16) >> 16))
+#define AS_FLOAT(val)   value_to_float(val)
+#define AS_OBJ(val)     ((Obj*)(uintptr_t)((val) & PAYLOAD_MASK))
+#define AS_ERROR(val)   ((char*)(uintptr_t)((val) & PAYLOAD_MASK))
+
+// Macros to check the type of an Ico Value
+#define IS_BOOL(val)    (((val) | 1) == TRUE_BITS)
+#define IS_NULL(val)    ((val) == NULL_BITS)
+#define IS_INT(val)     (((val) & BOX_TYPE_MASK) == INT_BITS)
+#define IS_FLOAT(val)   (((val) & QNAN) != QNAN)
+#define IS_OBJ(val)     (((val) & BOX_TYPE_MASK) == OBJ_BITS)
+#define IS_ERROR(val)   (((val) & BOX_TYPE_MASK) == ERROR_BITS)
+#define IS_NUMBER(val)  (IS_FLOAT(val) || IS_INT(val))
+
+// Get the type tag of a value (for switch cases)
+static inline ValueType value_type(IcoValue val) {
+    if (IS_FLOAT(val)) return VAL_FLOAT;
+    switch (val & BOX_TYPE_MASK) {
+        case INT_BITS:      return VAL_INT;
+        case OBJ_BITS:      return VAL_OBJ;
+        case ERROR_BITS:    return VAL_ERROR;
+        default:            return IS_NULL(val) ? VAL_NULL : VAL_BOOL;
+    }
+}
+#define VAL_TYPE(val)   value_type(val)
+
+// The raw 64 bits of a value (for hashing numbers)
+#define VAL_BITS(val)   (val)
+
+#else // !NAN_BOXING
+
 // A tagged union that can hold any type
 typedef struct {
     ValueType type;
@@ -30,7 +125,7 @@ typedef struct {
         double num_float;
         Obj* obj;
         char* error;
-        uint32_t ui32[2];
+        uint64_t bits;
     } as;
 } IcoValue;
 
@@ -38,15 +133,6 @@ typedef struct {
 _Static_assert( sizeof(IcoValue) <= 16,
     "C23 enum type is not supported, IcoValue is more than 16 bytes. Please disable this flag.");
 
-// By hashing the string ":)" and ":(" in advance
-#define TRUE_HASH (uint32_t)2231767820
-#define FALSE_HASH (uint32_t)2248545439
-
-// For read instruction
-#define R_STRING    (uint8_t)0
-#define R_NUM       (uint8_t)1
-#define R_BOOL      (uint8_t)2
-
 // Macros to convert native C values to Ico Value
 #define BOOL_VAL(b)     ((IcoValue){VAL_BOOL, false, {.boolean = b}})
 #define NULL_VAL        ((IcoValue){VAL_NULL, false, {.num_int = 0}})
@@ -55,6 +141,10 @@ _Static_assert( sizeof(IcoValue) <= 16,
 #define OBJ_VAL(o)      ((IcoValue){VAL_OBJ, false, {.obj = (Obj*)o}})
 #define ERROR_VAL(s)    ((IcoValue){VAL_ERROR, false, {.error = s}})
 
+// The range of ints
+#define INT_VAL_MAX     LONG_MAX
+#define INT_VAL_MIN     LONG_MIN
+
 // Macros to convert an Ico Value to a C-native value
 #define AS_BOOL(val)    ((val).as.boolean)
 #define AS_INT(val)     ((val).as.num_int)
@@ -71,6 +161,23 @@ _Static_assert( sizeof(IcoValue) <= 16,
 #define IS_ERROR(val)   ((val).type == VAL_ERROR)
 #define IS_NUMBER(val)  ((val).is_num)
 
+// Get the type tag of a value (for switch cases)
+#define VAL_TYPE(val)   ((val).type)
+
+// The raw 64 bits of a value's payload (for hashing numbers)
+#define VAL_BITS(val)   ((val).as.bits)
+
+#endif // NAN_BOXING
+
+// By hashing the string ":)" and ":(" in advance
+#define TRUE_HASH (uint32_t)2231767820
+#define FALSE_HASH (uint32_t)2248545439
+
+// For read instruction
+#define R_STRING    (uint8_t)0
+#define R_NUM       (uint8_t)1
+#define R_BOOL      (uint8_t)2
+
 // ValueArray to represent a constant pool of a chunk
 typedef struct {
     int capacity;
@@ -84,6 +191,9 @@ void init_value_array(ValueArray* val_arr);
 // Append a value to the end of a ValueArray
 void append_value_array(ValueArray* val_arr, IcoValue val);
 
+// Grow a ValueArray so that it holds "capacity" values without growing again
+void reserve_value_array(ValueArray* val_arr, int capacity);
+
 // Free the memory blocks of a ValueArray
 void free_value_array(ValueArray* val_arr);
 
@@ -5,13 +5,15 @@
 #include <time.h>
 #include <math.h>
 #include <ctype.h>
+#include <errno.h>
 
 #include "ico_common.h"
 #include "ico_vm.h"
 #include "ico_compiler.h"
 #include "ico_memory.h"
+#include "ico_heapdump.h"
 
-#ifdef DEBUG_TRACE_EXECUTION
+#if defined(DEBUG_TRACE_EXECUTION) || defined(DEBUG_INLINE_CACHE_STATS)
 #include "ico_debug.h"
 #endif
 
@@ -30,6 +32,54 @@ static void reset_stack() {
     vm.open_upvalues = NULL;
 }
 
+// Allocate a new block for the VM's stacks. Unlike reallocate(), this
+// never triggers the GC, because it's called in the middle of a push.
+static void* allocate_stack(size_t size) {
+    void* ptr = malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "Error: Out of memory.");
+        exit(1);
+    }
+    return ptr;
+}
+
+// Double the capacity of the value stack, then relocate all the
+// pointers into it: stack top, frame base pointers, and open upvalues.
+// Not inlined to keep push() small, as growing is rare.
+__attribute__((noinline)) static void grow_value_stack() {
+    IcoValue* old_stack = vm.stack;
+    size_t old_cap = vm.stack_end - vm.stack;
+    size_t new_cap = old_cap * 2;
+
+    IcoValue* new_stack = allocate_stack(sizeof(IcoValue) * new_cap);
+    memcpy(new_stack, old_stack, sizeof(IcoValue) * old_cap);
+
+    for (int i = 0; i < vm.frame_count; i++) {
+        vm.frames[i].base_ptr = new_stack + (vm.frames[i].base_ptr - old_stack);
+    }
+    for (ObjUpValue* upvalue = vm.open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = new_stack + (upvalue->location - old_stack);
+    }
+    vm.stack_top = new_stack + (vm.stack_top - old_stack);
+
+    vm.stack = new_stack;
+    vm.stack_end = new_stack + new_cap;
+    free(old_stack);
+}
+
+// Double the capacity of the call stack
+static void grow_call_stack() {
+    int new_cap = vm.frame_capacity * 2;
+    if (new_cap > vm.max_frames) new_cap = vm.max_frames;
+
+    CallFrame* new_frames = allocate_stack(sizeof(CallFrame) * new_cap);
+    memcpy(new_frames, vm.frames, sizeof(CallFrame) * vm.frame_count);
+    free(vm.frames);
+
+    vm.frames = new_frames;
+    vm.frame_capacity = new_cap;
+}
+
 // Peek the Value at distance away from the stack top
 static IcoValue peek(int distance) {
     // stack_top points to the next slot to be used, so -1 is the
@@ -52,13 +102,10 @@ static void concat_strings() {
     ObjString* s1 = AS_STRING(peek(1));
 
     // Populate the new ObjString
-    int concat_length = s1->length + s2->length;
-    char* concat_chars = ALLOCATE(char, concat_length + 1);
-    memcpy(concat_chars, s1->chars, s1->length);
-    memcpy(concat_chars + s1->length, s2->chars, s2->length);
-    concat_chars[concat_length] = '\0';
-
-    ObjString* result_obj = take_own_and_create_str_obj(concat_chars, concat_length);
+    ObjString* result_obj = new_str_obj(s1->length + s2->length);
+    memcpy(result_obj->chars, s1->chars, s1->length);
+    memcpy(result_obj->chars + s1->length, s2->chars, s2->length);
+    result_obj = finish_str_obj(result_obj);
     pop();
     pop();
     push(OBJ_VAL(result_obj));
@@ -100,14 +147,14 @@ static void runtime_error(const char* format_str, ...) {
     reset_stack(); // For the next REPL run
 }
 
-// Define a new native function and add it and its name
-// as value and key to the hash table of global variables.
+// Define a new native function as a global variable.
 static void define_native_func(const char* name, NativeFn func, int arity) {
     // Need to push then pop immediately due to garbage collection
     ObjString* name_obj = copy_and_create_str_obj(name, (int)strlen(name));
     push(OBJ_VAL(name_obj));
     push(OBJ_VAL(new_native_func_obj(func, arity, name_obj)));
-    table_set(&vm.globals, vm.stack[0], vm.stack[1]);
+    int slot = global_slot(name_obj); // May grow the array of globals
+    vm.globals.values[slot] = vm.stack[1];
     pop();
     pop();
 }
@@ -121,10 +168,13 @@ static bool call_obj_closure(ObjClosure* closure, int arg_count) {
         return false;
     }
 
-    // Check for call stack overflow
-    if (vm.frame_count == FRAMES_MAX) {
-        runtime_error("Call stack overflow.");
-        return false;
+    // Check for call stack overflow, or grow the call stack
+    if (vm.frame_count == vm.frame_capacity) {
+        if (vm.frame_count >= vm.max_frames) {
+            runtime_error("Call stack overflow.");
+            return false;
+        }
+        grow_call_stack();
     }
 
     // Set up a new call frame
@@ -136,6 +186,30 @@ static bool call_obj_closure(ObjClosure* closure, int arg_count) {
     return true;
 }
 
+// Call a native function with the arguments on the stack top.
+// Return false if there is an error.
+static inline bool call_native(ObjNative* native, int arg_count) {
+    if (arg_count != native->arity) {
+        runtime_error("Expect %d arguments but got %d.",
+            native->arity, arg_count);
+        return false;
+    }
+
+    // Call the C function
+    IcoValue ret_val = native->function(arg_count, vm.stack_top - arg_count);
+    if (IS_ERROR(ret_val)) {
+        runtime_error(AS_ERROR(ret_val));
+        return false;
+    }
+
+    // Discard the "call frame" (which only has arguments)
+    // and push the return value back
+    vm.stack_top -= arg_count + 1; // "+1" for the ObjNative
+    push(ret_val);
+
+    return true;
+}
+
 // Start a call on a Value by setting up a new CallFrame.
 // Return false if the value is not callable.
 static bool call_value(IcoValue callee, int arg_count) {
@@ -144,29 +218,8 @@ static bool call_value(IcoValue callee, int arg_count) {
             case OBJ_CLOSURE:
                 return call_obj_closure(AS_CLOSURE(callee), arg_count);
 
-            case OBJ_NATIVE: {
-                ObjNative* native = AS_NATIVE(callee);
-                if (arg_count != native->arity) {
-                    runtime_error("Expect %d arguments but got %d.",
-                        native->arity, arg_count);
-                    return false;
-                }
-
-                // Call the C function
-                NativeFn c_func = AS_NATIVE_C_FUNC(callee);
-                IcoValue ret_val = c_func(arg_count, vm.stack_top - arg_count);
-                if (IS_ERROR(ret_val)) {
-                    runtime_error(AS_ERROR(ret_val));
-                    return false;
-                }
-
-                // Discard the "call frame" (which only has arguments)
-                // and push the return value back
-                vm.stack_top -= arg_count + 1; // "+1" for the ObjNative
-                push(ret_val);
-
-                return true;
-            }
+            case OBJ_NATIVE:
+                return call_native(AS_NATIVE(callee), arg_count);
 
             default: // Non-callable Obj types
                 break;
@@ -218,11 +271,113 @@ static void close_all_upvalues_from(IcoValue* last) {
 
         curr->closed = *curr->location; // Copy the local var to the heap
         curr->location = &curr->closed; // Redirect to the hoisted value
+        write_barrier((Obj*)curr, curr->closed);
 
         vm.open_upvalues = curr->next;
     }
 }
 
+// Create a list from the (optional) prebuilt constant list "prefix" followed
+// by the top "elem_count" values on the stack, which are replaced by the list.
+// The element array is allocated once with its exact final size.
+static void create_list(ObjList* prefix, int elem_count) {
+    push(OBJ_VAL(new_list_obj())); // Create new ObjList
+    // Stack at this point: ...[e0][e1]..[en][list] <- top
+
+    int prefix_size = prefix == NULL ? 0 : prefix->array.size;
+    int size = prefix_size + elem_count;
+    if (size > 0) {
+        IcoValue* values = ALLOCATE(IcoValue, size);
+        if (prefix_size > 0) {
+            memcpy(values, prefix->array.values, sizeof(IcoValue) * prefix_size);
+        }
+        memcpy(values + prefix_size, vm.stack_top - elem_count - 1,
+            sizeof(IcoValue) * elem_count);
+
+        ObjList* list = AS_LIST(peek(0));
+        list->array.values = values;
+        list->array.size = size;
+        list->array.capacity = size;
+        write_barrier_all((Obj*)list); // The list may be promoted by ALLOCATE
+    }
+
+    vm.stack_top[- elem_count - 1] = peek(0); // Push the list
+    vm.stack_top -= elem_count; // Pop all elements
+}
+
+#ifdef DEBUG_INLINE_CACHE_STATS
+#define IC_STAT(counter) (counter++)
+#else
+#define IC_STAT(counter)
+#endif
+
+// Find the value of a field name (an interned string) in a table.
+// The inline cache of the access site is checked first, and it is
+// updated when missed. Return NULL if the table has no such key.
+static inline IcoValue* find_field(InlineCache* cache, ObjTable* obj_table, IcoValue name) {
+    Shape* shape = obj_table->shape;
+    if (shape != NULL) {
+        // Hit: the same shape has the key in the same slot
+        if (cache->shape == shape) {
+            IC_STAT(cache->hits);
+            return &obj_table->fields[cache->slot];
+        }
+
+        IC_STAT(cache->misses);
+        int slot = shape_find_slot(shape, name);
+        if (slot < 0) return NULL;
+
+        // The slot is now a field index, so the cache is in shape mode only
+        cache->shape = shape;
+        cache->entries = NULL;
+        cache->slot = (uint32_t)slot;
+        return &obj_table->fields[slot];
+    }
+
+    // Hit: same entries array and the cached entry still holds the name.
+    // Entries only move when the table is compacted, which the key catches.
+    Table* table = &obj_table->table;
+    if (cache->entries == table->entries && cache->slot < table->entry_count) {
+        Entry* entry = &table->entries[cache->slot];
+        if (IS_OBJ(entry->key) && AS_OBJ(entry->key) == AS_OBJ(name)) {
+            IC_STAT(cache->hits);
+            return &entry->value;
+        }
+    }
+
+    // Miss: do a normal lookup, then remember where the key is
+    IC_STAT(cache->misses);
+    uint32_t slot;
+    if (!table_find_slot(table, name, &slot)) return NULL;
+
+    // The slot is now an entry index, so the cache is in hash mode only
+    cache->shape = NULL;
+    cache->entries = table->entries;
+    cache->slot = slot;
+    return &table->entries[slot].value;
+}
+
+#undef IC_STAT
+
+// Handle the requests of the signal handlers and the GC, which the VM
+// defers to a safe point. Return false if there is a runtime error.
+static bool run_safepoint() {
+    vm.safepoint_requested = 0;
+
+    if (vm.heap_dump_requested) {
+        vm.heap_dump_requested = 0;
+        dump_heap_on_signal();
+    }
+
+    // See check_heap_limit() in ico_memory.c
+    if (vm.heap_limit_exceeded) {
+        vm.heap_limit_exceeded = false;
+        runtime_error("Heap limit of %zu bytes exceeded.", vm.gc_options.max_heap);
+        return false;
+    }
+    return true;
+}
+
 /*************************************
     THE MAIN VM EXECUTION FUNCTION
 **************************************/
@@ -258,6 +413,10 @@ static InterpretResult vm_run() {
 // Get the next 2 bytes as an unsigned short
 #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 
+// Get the inline cache indexed by the next 2 bytes
+#define READ_CACHE() \
+    (&curr_frame->closure->function->chunk.caches[READ_SHORT()])
+
 /* Exclusive to report runtime error in this function so that
 we don't forget to save the ip back to the call frame.
 Use C99's variadic macro. */
@@ -292,6 +451,100 @@ b is popped first because of LIFO.*/
     pop(); \
     }
 
+// Identity "value constructor" for BINARY_OP_RESULT to get a C bool
+#define C_BOOL(b) (b)
+
+/* Negated "value constructors" for ">=" and "<=", which are computed as
+"!(a < b)" and "!(a > b)" like the plain instruction sequence, so that
+a NaN operand gives the same result. */
+#define NOT_BOOL_VAL(b) BOOL_VAL(!(b))
+#define C_NOT_BOOL(b) (!(b))
+
+/* Common macro for the compare-and-branch superinstructions:
+pop the 2 operands and jump forward if the comparison is false.
+- boolVal: C_BOOL, or C_NOT_BOOL for a negated comparison */
+#define COMPARE_JUMP(boolVal, op) \
+    { \
+    uint16_t jump_dist = READ_SHORT(); \
+    IcoValue vb = peek(0); \
+    IcoValue va = peek(1); \
+    if (!IS_NUMBER(vb) || !IS_NUMBER(va)) { \
+        VM_RUNTIME_ERROR("Operands must be 2 numbers."); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } \
+    POP_N(2); \
+    if (!(BINARY_OP_RESULT(va, vb, boolVal, boolVal, op))) ip += jump_dist; \
+    }
+
+/* Common macro for local-constant arithmetic superinstructions. The compiler
+only emits these when the constant is a number, so the error message is
+the same as the one of the generic opcode. */
+#define LOCAL_CONST_OP(op, err_msg) \
+    { \
+    IcoValue va = curr_frame->base_ptr[READ_NEXT_BYTE()]; \
+    IcoValue vb = READ_CONSTANT(); \
+    if (!IS_NUMBER(va)) { \
+        VM_RUNTIME_ERROR(err_msg); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } \
+    push(BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, op)); \
+    }
+
+/* Quickening: when the generic instruction (just read) sees 2 ints or
+2 floats, rewrite it in place to its type-specialized version. Its _POLY
+version has the same code without the quickening. */
+#define QUICKEN(int_op, float_op) \
+    if (IS_INT(peek(0)) && IS_INT(peek(1))) ip[-1] = int_op; \
+    else if (IS_FLOAT(peek(0)) && IS_FLOAT(peek(1))) ip[-1] = float_op;
+
+/* Common macro for the type-specialized (quickened) binary operations.
+If an operand doesn't have the expected type, de-specialize the instruction
+to the _POLY version of the generic opcode and dispatch it again. The site
+is then never quickened again, so a site whose operand types keep changing
+doesn't rewrite its bytecode on every execution. */
+#define SPECIALIZED_OP(is_type, as_type, resultVal, op, poly_op) \
+    { \
+    IcoValue vb = peek(0); \
+    IcoValue va = peek(1); \
+    if (!is_type(va) || !is_type(vb)) { \
+        ip[-1] = poly_op; \
+        ip--; \
+        VM_BREAK; \
+    } \
+    vm.stack_top[-2] = resultVal(as_type(va) op as_type(vb)); \
+    pop(); \
+    }
+
+// Addition of 2 numbers, or concatenation of 2 strings
+#define ADD_OP() \
+    { \
+    IcoValue vb = peek(0); \
+    IcoValue va = peek(1); \
+    if (IS_STRING(va) && IS_STRING(vb)) { \
+        concat_strings(); \
+    } \
+    else if (IS_NUMBER(va) && IS_NUMBER(vb)) { \
+        vm.stack_top[-2] = BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, +); \
+        pop(); \
+    } \
+    else { \
+        VM_RUNTIME_ERROR("Operands must be 2 numbers or 2 strings."); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } \
+    }
+
+// Read the 2 operands of a register instruction from the frame's slots
+#define REGISTER_OPERANDS(va, vb) \
+    IcoValue va = curr_frame->base_ptr[READ_NEXT_BYTE()]; \
+    IcoValue vb = curr_frame->base_ptr[READ_NEXT_BYTE()]
+
+// Report a runtime error if one of the 2 operands is not a number
+#define CHECK_NUMBER_OPERANDS(va, vb) \
+    if (!IS_NUMBER(va) || !IS_NUMBER(vb)) { \
+        VM_RUNTIME_ERROR("Operands must be 2 numbers."); \
+        return INTERPRET_RUNTIME_ERROR; \
+    }
+
 // For checking int index of strings and lists
 #define CHECK_INT_IDX(index, i, size, container) \
     if (!IS_INT(index)) { \
@@ -307,6 +560,45 @@ b is popped first because of LIFO.*/
 // Pop n items from the VM stack
 #define POP_N(n) (vm.stack_top -= n)
 
+/* Handle the requests that wait for a safe point (see run_safepoint()).
+Checked at loops, calls and returns only, where the VM state is consistent. */
+#define SAFEPOINT() \
+    if (vm.safepoint_requested) { \
+        curr_frame->ip = ip; \
+        if (!run_safepoint()) return INTERPRET_RUNTIME_ERROR; \
+    }
+
+/* Call the callee below the arguments on the stack top.
+Closures with the right arity and natives are called directly when
+the call stack has room, everything else goes through call_value().
+Successful calls to closures add a new frame to the call stack,
+so curr_frame and ip are updated to execute the callee next. */
+#define CALL_OP(arg_count) \
+    { \
+    SAFEPOINT(); \
+    curr_frame->ip = ip; /* IMPORTANT: save ip back to frame */ \
+    IcoValue callee = peek(arg_count); \
+    if (IS_CLOSURE(callee) && AS_CLOSURE(callee)->function->arity == (arg_count) \
+            && vm.frame_count < vm.frame_capacity) { \
+        curr_frame = &vm.frames[vm.frame_count++]; \
+        curr_frame->closure = AS_CLOSURE(callee); \
+        curr_frame->base_ptr = vm.stack_top - (arg_count) - 1; \
+        ip = curr_frame->closure->function->chunk.chunk; \
+    } \
+    else if (IS_NATIVE(callee)) { \
+        if (!call_native(AS_NATIVE(callee), arg_count)) { \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+    } \
+    else { \
+        if (!call_value(callee, arg_count)) { \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        curr_frame = &vm.frames[vm.frame_count - 1]; \
+        ip = curr_frame->ip; \
+    } \
+    }
+
 #ifdef SWITCH_DISPATCH
 // Enabled when compiling in ANSI C or debug mode,
 // and can be enabled manually in ico_common.h
@@ -344,6 +636,7 @@ b is popped first because of LIFO.*/
         uint8_t instruction;
         VM_DISPATCH (instruction = READ_NEXT_BYTE()) {
             VM_CASE(OP_RETURN) {
+                SAFEPOINT();
                 IcoValue ret_val = pop();
 
                 // Pop the call frame from the call stack
@@ -392,10 +685,10 @@ b is popped first because of LIFO.*/
 
                 // Perform direct negation instead of pop then push
                 if (IS_INT(v)) {
-                    vm.stack_top[-1].as.num_int = -AS_INT(v);
+                    vm.stack_top[-1] = INT_VAL(-AS_INT(v));
                 }
                 else if (IS_FLOAT(v)) {
-                    vm.stack_top[-1].as.num_float = -AS_FLOAT(v);
+                    vm.stack_top[-1] = FLOAT_VAL(-AS_FLOAT(v));
                 }
                 else {
                     VM_RUNTIME_ERROR("Operand must be an int or a float.");
@@ -404,29 +697,35 @@ b is popped first because of LIFO.*/
                 VM_BREAK;
             }
 
-            VM_CASE(OP_ADD) { // OP_ADD also handles string concatenation
-                IcoValue vb = peek(0);
-                IcoValue va = peek(1);
-                if (IS_STRING(va) && IS_STRING(vb)) {
-                    concat_strings();
-                }
-                else if (IS_NUMBER(va) && IS_NUMBER(vb)) {
-                    vm.stack_top[-2] = BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, +);
-                    pop();
-                }
-                else {
-                    VM_RUNTIME_ERROR("Operands must be 2 numbers or 2 strings.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
+            VM_CASE(OP_ADD) {
+                QUICKEN(OP_ADD_INT_INT, OP_ADD_FLOAT_FLOAT);
+                ADD_OP();
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_ADD_POLY) {
+                ADD_OP();
                 VM_BREAK;
             }
 
             VM_CASE(OP_SUBTRACT) {
+                QUICKEN(OP_SUBTRACT_INT_INT, OP_SUBTRACT_FLOAT_FLOAT);
+                BINARY_OP(FLOAT_VAL, INT_VAL, -);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_SUBTRACT_POLY) {
                 BINARY_OP(FLOAT_VAL, INT_VAL, -);
                 VM_BREAK;
             }
 
             VM_CASE(OP_MULTIPLY) {
+                QUICKEN(OP_MULTIPLY_INT_INT, OP_MULTIPLY_FLOAT_FLOAT);
+                BINARY_OP(FLOAT_VAL, INT_VAL, *);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_MULTIPLY_POLY) {
                 BINARY_OP(FLOAT_VAL, INT_VAL, *);
                 VM_BREAK;
             }
@@ -496,11 +795,23 @@ b is popped first because of LIFO.*/
             }
 
             VM_CASE(OP_GREATER) {
+                QUICKEN(OP_GREATER_INT_INT, OP_GREATER_FLOAT_FLOAT);
+                BINARY_OP(BOOL_VAL, BOOL_VAL, >);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_GREATER_POLY) {
                 BINARY_OP(BOOL_VAL, BOOL_VAL, >);
                 VM_BREAK;
             }
 
             VM_CASE(OP_LESS) {
+                QUICKEN(OP_LESS_INT_INT, OP_LESS_FLOAT_FLOAT);
+                BINARY_OP(BOOL_VAL, BOOL_VAL, <);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_LESS_POLY) {
                 BINARY_OP(BOOL_VAL, BOOL_VAL, <);
                 VM_BREAK;
             }
@@ -524,24 +835,24 @@ b is popped first because of LIFO.*/
             }
 
             VM_CASE(OP_DEFINE_GLOBAL) {
-                // Insert the global variable and its initialized value
-                // into the globals hash table.
-                IcoValue var_name = READ_CONSTANT();
-                table_set(&vm.globals, var_name, peek(0));
+                // Store the initialized value in the global variable's slot,
+                // which was resolved by the compiler.
+                uint16_t slot = READ_SHORT();
+                vm.globals.values[slot] = peek(0);
 
-                // Need to pop AFTER the value is added to the globals table
+                // Need to pop AFTER the value is stored in the slot
                 // so that GC doesn't collect it.
                 pop();
                 VM_BREAK;
             }
 
             VM_CASE(OP_GET_GLOBAL) {
-                IcoValue var_name = READ_CONSTANT();
-                IcoValue value;
+                uint16_t slot = READ_SHORT();
+                IcoValue value = vm.globals.values[slot];
 
-                // Try to access the variable with this name
-                if (!table_get(&vm.globals, var_name, &value)) {
-                    VM_RUNTIME_ERROR("Undefined variable '%s'.", AS_STRING(var_name)->chars);
+                // Undefined slots hold an error value
+                if (IS_ERROR(value)) {
+                    VM_RUNTIME_ERROR("Undefined variable '%s'.", global_slot_name(slot)->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
@@ -551,16 +862,15 @@ b is popped first because of LIFO.*/
             }
 
             VM_CASE(OP_SET_GLOBAL) {
-                IcoValue var_name = READ_CONSTANT();
+                uint16_t slot = READ_SHORT();
 
-                // Try to set the variable value
-                if (table_set(&vm.globals, var_name, peek((0)))) {
-                    // If variable not already declared
-                    table_delete(&vm.globals, var_name);
-                    VM_RUNTIME_ERROR("Undefined variable '%s'.", AS_STRING(var_name)->chars);
+                // Can't assign to a variable that is not already declared
+                if (IS_ERROR(vm.globals.values[slot])) {
+                    VM_RUNTIME_ERROR("Undefined variable '%s'.", global_slot_name(slot)->chars);
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
+                vm.globals.values[slot] = peek(0);
                 VM_BREAK;
             }
 
@@ -594,26 +904,95 @@ b is popped first because of LIFO.*/
 
             VM_CASE(OP_LOOP) {
                 uint16_t jump_dist = READ_SHORT();
+                SAFEPOINT();
                 ip -= jump_dist; // jump back
                 VM_BREAK;
             }
 
             VM_CASE(OP_CALL) {
+                int arg_count = READ_NEXT_BYTE();
+                CALL_OP(arg_count);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_CALL_0) {
+                ip++; // Skip the arg count operand
+                CALL_OP(0);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_CALL_1) {
+                ip++;
+                CALL_OP(1);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_CALL_2) {
+                ip++;
+                CALL_OP(2);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_CALL_3) {
+                ip++;
+                CALL_OP(3);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_CALL_SELF) {
+                SAFEPOINT();
+                int arg_count = READ_NEXT_BYTE();
+                curr_frame->ip = ip; // IMPORTANT: save ip back to frame
+
+                // The callee is the current closure and the compiler has
+                // checked the arity, so only the call stack needs a check.
+                ObjClosure* closure = curr_frame->closure;
+                if (vm.frame_count == vm.frame_capacity) {
+                    if (!call_obj_closure(closure, arg_count)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    curr_frame = &vm.frames[vm.frame_count - 1];
+                }
+                else {
+                    curr_frame = &vm.frames[vm.frame_count++];
+                    curr_frame->closure = closure;
+                    curr_frame->base_ptr = vm.stack_top - arg_count - 1;
+                }
+                ip = closure->function->chunk.chunk;
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_TAIL_CALL) {
+                SAFEPOINT();
                 int arg_count = READ_NEXT_BYTE();
                 curr_frame->ip = ip; // IMPORTANT: save ip back to frame
+                IcoValue callee = peek(arg_count);
+
+                // Natives and errors: do a normal call. The OP_RETURN
+                // right after this instruction will return the result.
+                if (!IS_CLOSURE(callee)) {
+                    if (!call_value(callee, arg_count)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    VM_BREAK;
+                }
 
-                // stack_peek(arg_count) will be the callee value
-                if (!call_value(peek(arg_count), arg_count)) {
+                ObjClosure* closure = AS_CLOSURE(callee);
+                if (arg_count != closure->function->arity) {
+                    runtime_error("Expect %d arguments but got %d.",
+                        closure->function->arity, arg_count);
                     return INTERPRET_RUNTIME_ERROR;
                 }
 
-                // Successful call will add a new frame to the call stack
-                // so we need to update curr_frame and ip.
-                curr_frame = &vm.frames[vm.frame_count - 1];
-                ip = curr_frame->ip;
-                // After this, the VM will use the latest call frame
-                // for the code chunk and the ip to be executed next.
+                // Reuse the current frame: close its upvalues, then slide the
+                // callee and the arguments down to the start of the frame.
+                close_all_upvalues_from(curr_frame->base_ptr);
+                memmove(curr_frame->base_ptr, vm.stack_top - arg_count - 1,
+                    sizeof(IcoValue) * (arg_count + 1));
+                vm.stack_top = curr_frame->base_ptr + arg_count + 1;
 
+                curr_frame->closure = closure;
+                ip = closure->function->chunk.chunk;
                 VM_BREAK;
             }
 
@@ -641,6 +1020,8 @@ b is popped first because of LIFO.*/
                     }
                 }
 
+                // The closure may have been promoted while capturing upvalues
+                write_barrier_all((Obj*)closure);
                 VM_BREAK;
             }
 
@@ -652,7 +1033,9 @@ b is popped first because of LIFO.*/
 
             VM_CASE(OP_SET_UPVALUE) {
                 uint8_t upvalue_idx = READ_NEXT_BYTE();
-                *curr_frame->closure->upvalues[upvalue_idx]->location = peek(0);
+                ObjUpValue* upvalue = curr_frame->closure->upvalues[upvalue_idx];
+                *upvalue->location = peek(0);
+                write_barrier((Obj*)upvalue, peek(0));
                 VM_BREAK;
             }
 
@@ -692,6 +1075,7 @@ b is popped first because of LIFO.*/
 
                         // Attempt to parse both float and int
                         double d = strtod(buffer, &f_end);
+                        errno = 0;
                         long l = strtol(buffer, &i_end, 10);
 
                         if (f_end == buffer) {
@@ -699,7 +1083,9 @@ b is popped first because of LIFO.*/
                             return INTERPRET_RUNTIME_ERROR;
                         }
 
-                        if (f_end == i_end) {
+                        // An int out of the int range is read as a float
+                        if (f_end == i_end && errno != ERANGE
+                                && l >= INT_VAL_MIN && l <= INT_VAL_MAX) {
                             push(INT_VAL(l));
                         }
                         else {
@@ -745,18 +1131,15 @@ b is popped first because of LIFO.*/
             }
 
             VM_CASE(OP_CREATE_LIST) {
-                int elem_count = READ_NEXT_BYTE();
-                push(OBJ_VAL(new_list_obj())); // Create new ObjList
-                // Stack at this point: ...[e0][e1]..[en][list] <- top
-
-                ObjList* list = AS_LIST(peek(0));
-                IcoValue* elems = vm.stack_top - elem_count - 1;
-                while (elems < vm.stack_top - 1) { // Append all values to the list
-                    append_value_array(&list->array, *elems++);
-                }
+                int elem_count = READ_SHORT();
+                create_list(NULL, elem_count);
+                VM_BREAK;
+            }
 
-                vm.stack_top[- elem_count - 1] = peek(0); // Push the list
-                POP_N(elem_count); // Pop all elements
+            VM_CASE(OP_COPY_LIST) {
+                ObjList* prefix = AS_LIST(READ_CONSTANT());
+                int elem_count = READ_SHORT();
+                create_list(prefix, elem_count);
                 VM_BREAK;
             }
 
@@ -785,18 +1168,26 @@ b is popped first because of LIFO.*/
 
                     // Valid index
                     i = TRUE_INT_IDX(i, size);
-                    vm.stack_top[-2] = OBJ_VAL(get_substring_obj(string, i, i));
+                    IcoValue substring = OBJ_VAL(get_substring_obj(string, i, i)); // May move the stack
+                    vm.stack_top[-2] = substring;
                     pop(); // Pop the index
                 }
                 else if (IS_TABLE(container)) {
                     ObjTable* table = AS_TABLE(container);
 
+                    // Int keys of the array part are a bounds check and an index
+                    if (table_obj_in_array(table, index)) {
+                        vm.stack_top[-2] = table->array.values[AS_INT(index)];
+                        pop(); // Pop the index
+                        VM_BREAK;
+                    }
+
                     if (IS_NULL(index) || IS_LIST(index) || IS_TABLE(index)) {
                         VM_RUNTIME_ERROR("Can't use null, list, or table as key for table.");
                         return INTERPRET_RUNTIME_ERROR;
                     }
 
-                    if (!table_get(&table->table, index, vm.stack_top -2)) {
+                    if (!table_obj_get(table, index, vm.stack_top -2)) {
                         VM_RUNTIME_ERROR("Can't find this key in the table.");
                         return INTERPRET_RUNTIME_ERROR;
                     }
@@ -837,16 +1228,25 @@ b is popped first because of LIFO.*/
                     else {
                         list->array.values[TRUE_INT_IDX(i, size)] = peek(0);
                     }
+                    write_barrier((Obj*)list, peek(0));
                 }
                 else if (IS_TABLE(container)) { // ObjTable
                     ObjTable* table = AS_TABLE(container);
 
-                    if (IS_NULL(index) || IS_LIST(index) || IS_TABLE(index)) {
-                        VM_RUNTIME_ERROR("Can't use null, list, or table as key for table.");
-                        return INTERPRET_RUNTIME_ERROR;
+                    // Int keys of the array part are a bounds check and an index
+                    if (table_obj_in_array(table, index)) {
+                        table->array.values[AS_INT(index)] = peek(0);
                     }
+                    else {
+                        if (IS_NULL(index) || IS_LIST(index) || IS_TABLE(index)) {
+                            VM_RUNTIME_ERROR("Can't use null, list, or table as key for table.");
+                            return INTERPRET_RUNTIME_ERROR;
+                        }
 
-                    table_set(&table->table, index, peek(0));
+                        table_obj_set(table, index, peek(0));
+                        write_barrier((Obj*)table, index);
+                    }
+                    write_barrier((Obj*)table, peek(0));
                 }
                 else {
                     VM_RUNTIME_ERROR("Can only set element of list or table.");
@@ -874,7 +1274,8 @@ b is popped first because of LIFO.*/
                     CHECK_INT_IDX(end, ei, size, list);
 
                     // Valid index
-                    vm.stack_top[-3] = OBJ_VAL(get_sublist_obj(list, si, ei));
+                    IcoValue sublist = OBJ_VAL(get_sublist_obj(list, si, ei)); // May move the stack
+                    vm.stack_top[-3] = sublist;
                     POP_N(2); // Pop the indices
                 }
                 else if (IS_STRING(container)) { // ObjString
@@ -886,7 +1287,8 @@ b is popped first because of LIFO.*/
                     CHECK_INT_IDX(end, ei, size, list);
 
                     // Valid index
-                    vm.stack_top[-3] = OBJ_VAL(get_substring_obj(string, si, ei));
+                    IcoValue substring = OBJ_VAL(get_substring_obj(string, si, ei)); // May move the stack
+                    vm.stack_top[-3] = substring;
                     POP_N(2); // Pop the indices
                 }
                 else {
@@ -901,6 +1303,284 @@ b is popped first because of LIFO.*/
                 push(OBJ_VAL(new_table_obj()));
                 VM_BREAK;
             }
+
+            VM_CASE(OP_GET_FIELD) {
+                // Stack should be: ...[obj] <- top
+                IcoValue name = READ_CONSTANT();
+                InlineCache* cache = READ_CACHE();
+                IcoValue container = peek(0);
+
+                if (!IS_TABLE(container)) {
+                    // Same errors as subscripting with a string
+                    if (IS_LIST(container)) {
+                        VM_RUNTIME_ERROR("Index of a list must be an int.");
+                    }
+                    else if (IS_STRING(container)) {
+                        VM_RUNTIME_ERROR("Index of a string must be an int.");
+                    }
+                    else {
+                        VM_RUNTIME_ERROR("Can only subscript list, string, or table.");
+                    }
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                IcoValue* value = find_field(cache, AS_TABLE(container), name);
+                if (value == NULL) {
+                    VM_RUNTIME_ERROR("Can't find this key in the table.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                vm.stack_top[-1] = *value;
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_SET_FIELD) {
+                // Stack should be: ...[obj][val] <- top
+                IcoValue name = READ_CONSTANT();
+                InlineCache* cache = READ_CACHE();
+                IcoValue container = peek(1);
+
+                if (!IS_TABLE(container)) {
+                    // Same errors as setting an element with a string
+                    if (IS_LIST(container)) {
+                        VM_RUNTIME_ERROR("Index of a list must be an int.");
+                    }
+                    else {
+                        VM_RUNTIME_ERROR("Can only set element of list or table.");
+                    }
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                ObjTable* table = AS_TABLE(container);
+                IcoValue* value = find_field(cache, table, name);
+                if (value != NULL) {
+                    *value = peek(0);
+                }
+                else { // New key
+                    table_obj_set(table, name, peek(0));
+                    write_barrier(AS_OBJ(container), name);
+                }
+                write_barrier(AS_OBJ(container), peek(0));
+
+                vm.stack_top[-2] = peek(0); // Value of the assignment expr
+                pop();
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_NOT_EQUAL) {
+                push(BOOL_VAL(!values_equal(pop(), pop())));
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_GREATER_EQUAL) {
+                BINARY_OP(NOT_BOOL_VAL, NOT_BOOL_VAL, <);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_LESS_EQUAL) {
+                BINARY_OP(NOT_BOOL_VAL, NOT_BOOL_VAL, >);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_JUMP_IF_NOT_EQUAL) {
+                uint16_t jump_dist = READ_SHORT();
+                if (!values_equal(pop(), pop())) ip += jump_dist;
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_JUMP_IF_NOT_NOT_EQUAL) {
+                uint16_t jump_dist = READ_SHORT();
+                if (values_equal(pop(), pop())) ip += jump_dist;
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_JUMP_IF_NOT_GREATER) {
+                COMPARE_JUMP(C_BOOL, >);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_JUMP_IF_NOT_GREATER_EQUAL) {
+                COMPARE_JUMP(C_NOT_BOOL, <);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_JUMP_IF_NOT_LESS) {
+                COMPARE_JUMP(C_BOOL, <);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_JUMP_IF_NOT_LESS_EQUAL) {
+                COMPARE_JUMP(C_NOT_BOOL, >);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_ADD_LOCAL_CONST) {
+                LOCAL_CONST_OP(+, "Operands must be 2 numbers or 2 strings.");
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_SUBTRACT_LOCAL_CONST) {
+                LOCAL_CONST_OP(-, "Operands must be 2 numbers.");
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_INCREMENT_LOCAL) {
+                IcoValue* local = &curr_frame->base_ptr[READ_NEXT_BYTE()];
+                IcoValue vb = READ_CONSTANT();
+                IcoValue va = *local;
+                if (!IS_NUMBER(va)) {
+                    VM_RUNTIME_ERROR("Operands must be 2 numbers or 2 strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                *local = BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, +);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_ADD_RR) {
+                REGISTER_OPERANDS(va, vb);
+                if (IS_NUMBER(va) && IS_NUMBER(vb)) {
+                    push(BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, +));
+                }
+                else if (IS_STRING(va) && IS_STRING(vb)) {
+                    push(va);
+                    push(vb);
+                    concat_strings();
+                }
+                else {
+                    VM_RUNTIME_ERROR("Operands must be 2 numbers or 2 strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_SUBTRACT_RR) {
+                REGISTER_OPERANDS(va, vb);
+                CHECK_NUMBER_OPERANDS(va, vb);
+                push(BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, -));
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_MULTIPLY_RR) {
+                REGISTER_OPERANDS(va, vb);
+                CHECK_NUMBER_OPERANDS(va, vb);
+                push(BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, *));
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_GREATER_RR) {
+                REGISTER_OPERANDS(va, vb);
+                CHECK_NUMBER_OPERANDS(va, vb);
+                push(BINARY_OP_RESULT(va, vb, BOOL_VAL, BOOL_VAL, >));
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_LESS_RR) {
+                REGISTER_OPERANDS(va, vb);
+                CHECK_NUMBER_OPERANDS(va, vb);
+                push(BINARY_OP_RESULT(va, vb, BOOL_VAL, BOOL_VAL, <));
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_ADD_RRR) {
+                uint8_t dest = READ_NEXT_BYTE(); // Index, as push() may move the stack
+                REGISTER_OPERANDS(va, vb);
+                if (IS_NUMBER(va) && IS_NUMBER(vb)) {
+                    curr_frame->base_ptr[dest] = BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, +);
+                }
+                else if (IS_STRING(va) && IS_STRING(vb)) {
+                    push(va);
+                    push(vb);
+                    concat_strings();
+                    curr_frame->base_ptr[dest] = pop();
+                }
+                else {
+                    VM_RUNTIME_ERROR("Operands must be 2 numbers or 2 strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_SUBTRACT_RRR) {
+                uint8_t dest = READ_NEXT_BYTE();
+                REGISTER_OPERANDS(va, vb);
+                CHECK_NUMBER_OPERANDS(va, vb);
+                curr_frame->base_ptr[dest] = BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, -);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_MULTIPLY_RRR) {
+                uint8_t dest = READ_NEXT_BYTE();
+                REGISTER_OPERANDS(va, vb);
+                CHECK_NUMBER_OPERANDS(va, vb);
+                curr_frame->base_ptr[dest] = BINARY_OP_RESULT(va, vb, FLOAT_VAL, INT_VAL, *);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_JUMP_IF_NOT_GREATER_RR) {
+                REGISTER_OPERANDS(va, vb);
+                uint16_t jump_dist = READ_SHORT();
+                CHECK_NUMBER_OPERANDS(va, vb);
+                if (!(BINARY_OP_RESULT(va, vb, C_BOOL, C_BOOL, >))) ip += jump_dist;
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_JUMP_IF_NOT_LESS_RR) {
+                REGISTER_OPERANDS(va, vb);
+                uint16_t jump_dist = READ_SHORT();
+                CHECK_NUMBER_OPERANDS(va, vb);
+                if (!(BINARY_OP_RESULT(va, vb, C_BOOL, C_BOOL, <))) ip += jump_dist;
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_ADD_INT_INT) {
+                SPECIALIZED_OP(IS_INT, AS_INT, INT_VAL, +, OP_ADD_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_ADD_FLOAT_FLOAT) {
+                SPECIALIZED_OP(IS_FLOAT, AS_FLOAT, FLOAT_VAL, +, OP_ADD_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_SUBTRACT_INT_INT) {
+                SPECIALIZED_OP(IS_INT, AS_INT, INT_VAL, -, OP_SUBTRACT_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_SUBTRACT_FLOAT_FLOAT) {
+                SPECIALIZED_OP(IS_FLOAT, AS_FLOAT, FLOAT_VAL, -, OP_SUBTRACT_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_MULTIPLY_INT_INT) {
+                SPECIALIZED_OP(IS_INT, AS_INT, INT_VAL, *, OP_MULTIPLY_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_MULTIPLY_FLOAT_FLOAT) {
+                SPECIALIZED_OP(IS_FLOAT, AS_FLOAT, FLOAT_VAL, *, OP_MULTIPLY_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_GREATER_INT_INT) {
+                SPECIALIZED_OP(IS_INT, AS_INT, BOOL_VAL, >, OP_GREATER_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_GREATER_FLOAT_FLOAT) {
+                SPECIALIZED_OP(IS_FLOAT, AS_FLOAT, BOOL_VAL, >, OP_GREATER_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_LESS_INT_INT) {
+                SPECIALIZED_OP(IS_INT, AS_INT, BOOL_VAL, <, OP_LESS_POLY);
+                VM_BREAK;
+            }
+
+            VM_CASE(OP_LESS_FLOAT_FLOAT) {
+                SPECIALIZED_OP(IS_FLOAT, AS_FLOAT, BOOL_VAL, <, OP_LESS_POLY);
+                VM_BREAK;
+            }
         }
     }
 
@@ -908,6 +1588,7 @@ b is popped first because of LIFO.*/
 #undef READ_NEXT_BYTE
 #undef READ_CONSTANT
 #undef READ_SHORT
+#undef READ_CACHE
 #undef BINARY_OP
 #undef BINARY_OP_RESULT
 #undef VM_DISPATCH
@@ -916,6 +1597,18 @@ b is popped first because of LIFO.*/
 #undef VM_RUNTIME_ERROR
 #undef CHECK_INT_IDX
 #undef POP_N
+#undef SAFEPOINT
+#undef C_BOOL
+#undef NOT_BOOL_VAL
+#undef C_NOT_BOOL
+#undef COMPARE_JUMP
+#undef LOCAL_CONST_OP
+#undef QUICKEN
+#undef REGISTER_OPERANDS
+#undef CHECK_NUMBER_OPERANDS
+#undef SPECIALIZED_OP
+#undef ADD_OP
+#undef CALL_OP
 }
 
 //------------------------------
@@ -929,7 +1622,13 @@ static IcoValue clock_native(int arg_count, IcoValue* args) {
 static IcoValue floor_native(int arg_count, IcoValue* args) {
     IcoValue v = args[0];
     if (IS_FLOAT(v)) {
-        return INT_VAL((long)floor(AS_FLOAT(v)));
+        // Also false for NaN. INT_VAL_MIN is a power of 2, so it and
+        // its negation are exact doubles.
+        double f = floor(AS_FLOAT(v));
+        if (!(f >= (double)INT_VAL_MIN && f < -(double)INT_VAL_MIN)) {
+            return ERROR_VAL("Can't floor a float out of the int range.");
+        }
+        return INT_VAL((long)f);
     }
     else if (IS_INT(v)) {
         return v;
@@ -948,15 +1647,7 @@ static IcoValue len_native(int arg_count, IcoValue* args) {
         return INT_VAL(AS_STRING(v)->length);
     }
     else if (IS_TABLE(v)) {
-        // Can't use `count` because it includes tombstone
-        Entry* entries = AS_TABLE(v)->table.entries;
-        int len = 0;
-        for (uint32_t i = 0; i < AS_TABLE(v)->table.capacity; i++) {
-            if (!IS_NULL(entries[i].key)) {
-                len++;
-            }
-        }
-        return INT_VAL(len);
+        return INT_VAL(table_obj_count(AS_TABLE(v)));
     }
     else {
         return ERROR_VAL("Can only get length of string, list, or table.");
@@ -983,6 +1674,51 @@ static IcoValue deep_copy_native(int arg_count, IcoValue* args) {
     }
 }
 
+// Write a snapshot of the reachable objects to a file, and
+// return the number of objects
+static IcoValue dump_heap_native(int arg_count, IcoValue* args) {
+    if (!IS_STRING(args[0])) {
+        return ERROR_VAL("The path of a heap dump must be a string.");
+    }
+    long object_count = dump_heap(AS_C_STRING(args[0]));
+    if (object_count < 0) {
+        return ERROR_VAL("Could not write the heap dump.");
+    }
+    return INT_VAL(object_count);
+}
+
+// Run a full collection and return the number of freed bytes
+static IcoValue gc_collect_native(int arg_count, IcoValue* args) {
+    size_t before = vm.bytes_allocated;
+    collect_garbage();
+    return INT_VAL(before > vm.bytes_allocated ? before - vm.bytes_allocated : 0);
+}
+
+// Set a field of a table that is on the stack top
+static void set_stat_field(const char* name, IcoValue value) {
+    push(OBJ_VAL(copy_and_create_str_obj(name, (int)strlen(name))));
+    ObjTable* table = AS_TABLE(peek(1));
+    table_obj_set(table, peek(0), value);
+    write_barrier((Obj*)table, peek(0));
+    pop();
+}
+
+// Return a table of the heap size, GC thresholds and GC counters
+static IcoValue gc_stats_native(int arg_count, IcoValue* args) {
+    push(OBJ_VAL(new_table_obj()));
+    set_stat_field("bytesAllocated", INT_VAL(vm.bytes_allocated));
+    set_stat_field("nextCollection", INT_VAL(vm.next_gc_run));
+    set_stat_field("maxHeap", vm.gc_options.max_heap == SIZE_MAX ?
+        NULL_VAL : INT_VAL(vm.gc_options.max_heap));
+    set_stat_field("growFactor", FLOAT_VAL(vm.gc_options.grow_factor));
+    set_stat_field("fullCollections", INT_VAL(vm.gc_cycle_count));
+    set_stat_field("minorCollections", INT_VAL(vm.gc_minor_count));
+    set_stat_field("pauses", INT_VAL(vm.gc_pause_count));
+    set_stat_field("pauseTotalUs", INT_VAL(vm.gc_pause_total));
+    set_stat_field("pauseMaxUs", INT_VAL(vm.gc_pause_max));
+    return pop();
+}
+
 //------------------------------
 //      HEADER FUNCTIONS
 //------------------------------
@@ -990,30 +1726,62 @@ static IcoValue deep_copy_native(int arg_count, IcoValue* args) {
 // The global VM variable/object
 VM vm;
 
-void init_vm(bool is_repl) {
+void init_vm(bool is_repl, bool use_registers, int max_frames, GCOptions gc_options) {
     // This function will be used by main.c
 
+    // Allocate the stacks. They grow on demand. The call stack never
+    // holds more than max_frames, as the calls only check the capacity.
+    int frame_capacity = max_frames < FRAMES_INIT_SIZE ? max_frames : FRAMES_INIT_SIZE;
+    vm.frames = allocate_stack(sizeof(CallFrame) * frame_capacity);
+    vm.frame_capacity = frame_capacity;
+    vm.max_frames = max_frames;
+    vm.stack = allocate_stack(sizeof(IcoValue) * STACK_INIT_SIZE);
+    vm.stack_end = vm.stack + STACK_INIT_SIZE;
+
     reset_stack();
 
     // No allocated Objs yet
-    vm.allocated_objs = NULL;
+    vm.young_objs = NULL;
+    vm.young_count = 0;
+    vm.young_capacity = 0;
 
-    // Initialize the gray stack (for GC)
+    // Initialize the gray stack and the remembered set (for GC)
     vm.gray_count = 0;
     vm.gray_capacity = 0;
     vm.gray_stack = NULL;
+    vm.remembered_count = 0;
+    vm.remembered_capacity = 0;
+    vm.remembered = NULL;
 
     // Initialize the GC trigger
     vm.bytes_allocated = 0;
-    vm.next_gc_run = 1024 * 1024; // Arbitrarily chosen -> See book/notebook
+    vm.next_gc_run = gc_options.initial_threshold;
+    vm.nursery_bytes = 0;
+    vm.gc_step_bytes = 0;
+    vm.gc_phase = GC_IDLE;
+    vm.gc_minor = false;
+    vm.gc_options = gc_options;
+    vm.gc_cycle_count = 0;
+    vm.gc_minor_count = 0;
+    vm.gc_pause_count = 0;
+    vm.gc_pause_total = 0;
+    vm.gc_pause_max = 0;
+    vm.heap_limit_exceeded = false;
+    vm.heap_dump_requested = 0;
+    vm.safepoint_requested = 0;
 
     // Is REPL?
     vm.is_repl = is_repl;
     vm.stored_val = ERROR_VAL(NULL);
 
+    // Compile with register instructions?
+    vm.use_registers = use_registers;
+
     // Initialize the hash tables
-    init_table(&vm.globals); // table of global variables
+    init_table(&vm.global_slots); // table of global variable slots
+    init_value_array(&vm.globals); // array of global variable values
     init_table(&vm.strings); // table for string interning
+    init_shapes(); // the empty shape of tables
 
     // Add native functions
     define_native_func("clock", clock_native, 0);
@@ -1021,13 +1789,43 @@ void init_vm(bool is_repl) {
     define_native_func("len", len_native, 1);
     define_native_func("shallowCopy", shallow_copy_native, 1);
     define_native_func("deepCopy", deep_copy_native, 1);
+    define_native_func("gcCollect", gc_collect_native, 0);
+    define_native_func("gcStats", gc_stats_native, 0);
+    define_native_func("dumpHeap", dump_heap_native, 1);
 }
 
 void free_vm() {
-    free_table(&vm.globals);
+#ifdef DEBUG_SLAB_STATS
+    print_slab_stats();
+#endif
+
+#ifdef DEBUG_GC_STATS
+    print_gc_stats();
+#endif
+
+    free_table(&vm.global_slots);
+    free_value_array(&vm.globals);
     free_table(&vm.strings);
+    free_shapes();
     free_objects();
+    free(vm.frames);
+    free(vm.stack);
+
+#ifdef DEBUG_VERIFY_HEAP
+    if (!verify_heap()) exit(1);
+#endif
+}
+
+#ifdef DEBUG_INLINE_CACHE_STATS
+// Dump the inline cache counters of an object if it is a function
+static void dump_function_caches(Obj* obj) {
+    if (obj->type == OBJ_FUNCTION) {
+        ObjFunction* func = (ObjFunction*)obj;
+        dump_inline_caches(&func->chunk,
+            func->name != NULL ? func->name->chars : "<top level script>");
+    }
 }
+#endif
 
 InterpretResult vm_interpret(const char *source_code) {
     // // Compile the source code and get the ObjFunction for top-level code
@@ -1041,7 +1839,15 @@ InterpretResult vm_interpret(const char *source_code) {
     push(OBJ_VAL(top_level_closure));
     call_obj_closure(top_level_closure, 0);
 
+#ifdef DEBUG_INLINE_CACHE_STATS
+    InterpretResult result = vm_run();
+
+    // Dump the inline cache counters of all live functions
+    for_each_object(dump_function_caches);
+    return result;
+#else
     return vm_run();
+#endif
 }
 
 void vm_print_stored_val() {
@@ -1050,17 +1856,48 @@ void vm_print_stored_val() {
 }
 
 /*
-The reason for not checking for empty stack or stack overflow
-is performance. Pop and push is used a lot, and checking is expensive.
-Instead, the compiler takes care to use precise numbers of
-pops and pushes, allowing stack operation to be fast.
+The reason for not checking for empty stack is performance. Pop and push
+is used a lot, and the compiler takes care to use precise numbers of pops
+and pushes. Push only checks for a full stack (a single comparison), and
+grows it. Therefore, code that calls push() must not hold a pointer into
+the value stack across the call.
 */
 
 void push(IcoValue val) {
+    if (vm.stack_top == vm.stack_end) grow_value_stack();
     *vm.stack_top = val;
     vm.stack_top++;
 }
 
+int global_slot(ObjString* name) {
+    IcoValue slot;
+    if (table_get(&vm.global_slots, OBJ_VAL(name), &slot)) {
+        return (int)AS_INT(slot);
+    }
+
+    // New global variable -> Add an undefined slot for it.
+    // Push the name so that GC doesn't collect it.
+    int new_slot = vm.globals.size;
+    push(OBJ_VAL(name));
+    append_value_array(&vm.globals, ERROR_VAL(NULL));
+    table_set(&vm.global_slots, OBJ_VAL(name), INT_VAL(new_slot));
+    pop();
+    return new_slot;
+}
+
+ObjString* global_slot_name(int slot) {
+    // Only used for error messages and debugging,
+    // so a linear scan of the table is fine.
+    Table* table = &vm.global_slots;
+    for (uint32_t i = 0; i < table->entry_count; i++) {
+        Entry* entry = &table->entries[i];
+        if (IS_STRING(entry->key) && AS_INT(entry->value) == slot) {
+            return AS_STRING(entry->key);
+        }
+    }
+    return NULL; // Unreachable
+}
+
 IcoValue pop() {
     vm.stack_top--;
     return *vm.stack_top;
@@ -1,14 +1,20 @@
 #ifndef ICO_VM_H
 #define ICO_VM_H
 
+#include <signal.h>
+
 #include "ico_chunk.h"
 #include "ico_value.h"
 #include "ico_table.h"
 #include "ico_object.h"
 
-#define FRAMES_MAX 64 // Maximum call depth
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#define FRAMES_INIT_SIZE 8          // Initial capacity of the call stack
+#define STACK_INIT_SIZE UINT8_COUNT // Initial capacity of the value stack
+#define DEFAULT_MAX_FRAMES 1024     // Default maximum call depth
 #define USER_INPUT_BUFF_SIZE 1024
+#define DEFAULT_PARALLEL_MARK_HEAP (64 * 1024 * 1024) // Default heap size for parallel marking
+#define DEFAULT_GC_THRESHOLD (1024 * 1024) // Default heap size of the first full collection
+#define DEFAULT_GC_GROW_FACTOR 2.0         // Default heap growth between full collections
 
 typedef struct {
     ObjClosure* closure;
@@ -16,22 +22,63 @@ typedef struct {
     IcoValue* base_ptr;
 } CallFrame;
 
+// The phases of a full GC cycle, which can be split into slices
+typedef enum {
+    GC_IDLE,        // No full collection in progress
+    GC_MARKING,     // Tracing the heap from the roots
+    GC_SWEEPING,    // Freeing the unmarked objects of the old generation
+} GCPhase;
+
+// Options of the garbage collector
+typedef struct {
+    uint64_t pause_target;      // Max length of a GC slice in microseconds (0: no slices)
+    int mark_threads;           // Number of threads that mark the heap in a full collection
+    size_t parallel_mark_heap;  // Heap size in bytes from which the marking is parallel
+    size_t initial_threshold;   // Heap size in bytes that triggers the first full collection
+    double grow_factor;         // The next collection runs when the live heap has grown by this factor
+    size_t min_interval;        // Minimum bytes allocated between two full collections
+    size_t max_heap;            // Heap size in bytes that is a runtime error (SIZE_MAX: no limit)
+} GCOptions;
+
 // This struct represents the state of an Ico VM
 typedef struct {
-    CallFrame frames[FRAMES_MAX];       // The VM's call stack (aka the VM's stack)
+    CallFrame* frames;                  // The VM's call stack (aka the VM's stack)
     int frame_count;                    // The current frame count (aka top of call stack)
-    IcoValue stack[STACK_MAX];          // The value stack
+    int frame_capacity;                 // The capacity of the call stack
+    int max_frames;                     // The maximum call depth
+    IcoValue* stack;                    // The value stack
     IcoValue* stack_top;                // The value stack pointer (to next slot to-be-used)
-    Obj* allocated_objs;                // Linked list of allocated Obj for memory management
+    IcoValue* stack_end;                // The end of the allocated value stack
+    Obj** young_objs;                   // GC: Obj allocated since the last collection
+    int young_count;                    // GC: number of young objects
+    int young_capacity;                 // GC: capacity of the young object array
     Table strings;                      // For string interning
-    Table globals;                      // To store global variables
+    Table global_slots;                 // Names of global variables -> their slot indices
+    ValueArray globals;                 // The values of global variables, by slot index
     ObjUpValue* open_upvalues;          // The list of open upvalues
     Obj** gray_stack;                   // GC: stack of gray objects
     int gray_count;                     // GC: number of gray objects
     int gray_capacity;                  // GC: capacity of the gray stack
+    Obj** remembered;                   // GC: old objects that may reference young objects
+    int remembered_count;               // GC: number of remembered objects
+    int remembered_capacity;            // GC: capacity of the remembered set
     size_t bytes_allocated;             // GC: Number of bytes allocated
     size_t next_gc_run;                 // GC: Threshold for next GC run
+    size_t nursery_bytes;               // GC: Number of bytes allocated since the last GC
+    size_t gc_step_bytes;               // GC: Number of bytes allocated since the last slice
+    GCPhase gc_phase;                   // GC: Phase of the current full collection
+    bool gc_minor;                      // GC: true during a minor collection
+    GCOptions gc_options;               // GC: Options set from the command line
+    size_t gc_cycle_count;              // GC stats: Number of full collections
+    size_t gc_minor_count;              // GC stats: Number of minor collections
+    size_t gc_pause_count;              // GC stats: Number of pauses (collections and slices)
+    uint64_t gc_pause_total;            // GC stats: Total pause time in microseconds
+    uint64_t gc_pause_max;              // GC stats: Longest pause in microseconds
+    bool heap_limit_exceeded;           // GC: The heap outgrew gc_options.max_heap
+    volatile sig_atomic_t heap_dump_requested;  // A heap dump was requested with SIGUSR1
+    volatile sig_atomic_t safepoint_requested;  // Something waits for the next safe point
     bool is_repl;                       // REPL: will be true if in REPL
+    bool use_registers;                 // Compiler: emit register instructions for locals
     IcoValue stored_val;                // REPL: the final value of a REPL iteration
 } VM;
 
@@ -48,7 +95,7 @@ typedef enum {
 extern VM vm;
 
 // Initialize a VM
-void init_vm(bool is_repl);
+void init_vm(bool is_repl, bool use_registers, int max_frames, GCOptions gc_options);
 
 // Tear down a VM
 void free_vm();
@@ -65,4 +112,11 @@ void push(IcoValue val);
 // Pop the Value at the top of the VM's stack
 IcoValue pop();
 
+// Return the slot index of the global variable with the passed name.
+// A new slot holding an undefined value is added if the name is new.
+int global_slot(ObjString* name);
+
+// Return the name of the global variable at the passed slot index.
+ObjString* global_slot_name(int slot);
+
 #endif // !ICO_VM_H
@@ -43,6 +43,12 @@ static const void* const label_table[] = {
     [OP_JUMP] = &&L_OP_JUMP,
     [OP_LOOP] = &&L_OP_LOOP,
     [OP_CALL] = &&L_OP_CALL,
+    [OP_CALL_0] = &&L_OP_CALL_0,
+    [OP_CALL_1] = &&L_OP_CALL_1,
+    [OP_CALL_2] = &&L_OP_CALL_2,
+    [OP_CALL_3] = &&L_OP_CALL_3,
+    [OP_CALL_SELF] = &&L_OP_CALL_SELF,
+    [OP_TAIL_CALL] = &&L_OP_TAIL_CALL,
     [OP_CLOSURE] = &&L_OP_CLOSURE,
     [OP_GET_UPVALUE] = &&L_OP_GET_UPVALUE,
     [OP_SET_UPVALUE] = &&L_OP_SET_UPVALUE,
@@ -50,8 +56,48 @@ static const void* const label_table[] = {
     [OP_STORE_VAL] = &&L_OP_STORE_VAL,
     [OP_READ] = &&L_OP_READ,
     [OP_CREATE_LIST] = &&L_OP_CREATE_LIST,
+    [OP_COPY_LIST] = &&L_OP_COPY_LIST,
     [OP_GET_ELEMENT] = &&L_OP_GET_ELEMENT,
     [OP_SET_ELEMENT] = &&L_OP_SET_ELEMENT,
     [OP_GET_RANGE] = &&L_OP_GET_RANGE,
     [OP_CREATE_TABLE] = &&L_OP_CREATE_TABLE,
+    [OP_GET_FIELD] = &&L_OP_GET_FIELD,
+    [OP_SET_FIELD] = &&L_OP_SET_FIELD,
+    [OP_NOT_EQUAL] = &&L_OP_NOT_EQUAL,
+    [OP_GREATER_EQUAL] = &&L_OP_GREATER_EQUAL,
+    [OP_LESS_EQUAL] = &&L_OP_LESS_EQUAL,
+    [OP_JUMP_IF_NOT_EQUAL] = &&L_OP_JUMP_IF_NOT_EQUAL,
+    [OP_JUMP_IF_NOT_NOT_EQUAL] = &&L_OP_JUMP_IF_NOT_NOT_EQUAL,
+    [OP_JUMP_IF_NOT_GREATER] = &&L_OP_JUMP_IF_NOT_GREATER,
+    [OP_JUMP_IF_NOT_GREATER_EQUAL] = &&L_OP_JUMP_IF_NOT_GREATER_EQUAL,
+    [OP_JUMP_IF_NOT_LESS] = &&L_OP_JUMP_IF_NOT_LESS,
+    [OP_JUMP_IF_NOT_LESS_EQUAL] = &&L_OP_JUMP_IF_NOT_LESS_EQUAL,
+    [OP_ADD_LOCAL_CONST] = &&L_OP_ADD_LOCAL_CONST,
+    [OP_SUBTRACT_LOCAL_CONST] = &&L_OP_SUBTRACT_LOCAL_CONST,
+    [OP_INCREMENT_LOCAL] = &&L_OP_INCREMENT_LOCAL,
+    [OP_ADD_RR] = &&L_OP_ADD_RR,
+    [OP_SUBTRACT_RR] = &&L_OP_SUBTRACT_RR,
+    [OP_MULTIPLY_RR] = &&L_OP_MULTIPLY_RR,
+    [OP_GREATER_RR] = &&L_OP_GREATER_RR,
+    [OP_LESS_RR] = &&L_OP_LESS_RR,
+    [OP_ADD_RRR] = &&L_OP_ADD_RRR,
+    [OP_SUBTRACT_RRR] = &&L_OP_SUBTRACT_RRR,
+    [OP_MULTIPLY_RRR] = &&L_OP_MULTIPLY_RRR,
+    [OP_JUMP_IF_NOT_GREATER_RR] = &&L_OP_JUMP_IF_NOT_GREATER_RR,
+    [OP_JUMP_IF_NOT_LESS_RR] = &&L_OP_JUMP_IF_NOT_LESS_RR,
+    [OP_ADD_INT_INT] = &&L_OP_ADD_INT_INT,
+    [OP_ADD_FLOAT_FLOAT] = &&L_OP_ADD_FLOAT_FLOAT,
+    [OP_SUBTRACT_INT_INT] = &&L_OP_SUBTRACT_INT_INT,
+    [OP_SUBTRACT_FLOAT_FLOAT] = &&L_OP_SUBTRACT_FLOAT_FLOAT,
+    [OP_MULTIPLY_INT_INT] = &&L_OP_MULTIPLY_INT_INT,
+    [OP_MULTIPLY_FLOAT_FLOAT] = &&L_OP_MULTIPLY_FLOAT_FLOAT,
+    [OP_GREATER_INT_INT] = &&L_OP_GREATER_INT_INT,
+    [OP_GREATER_FLOAT_FLOAT] = &&L_OP_GREATER_FLOAT_FLOAT,
+    [OP_LESS_INT_INT] = &&L_OP_LESS_INT_INT,
+    [OP_LESS_FLOAT_FLOAT] = &&L_OP_LESS_FLOAT_FLOAT,
+    [OP_ADD_POLY] = &&L_OP_ADD_POLY,
+    [OP_SUBTRACT_POLY] = &&L_OP_SUBTRACT_POLY,
+    [OP_MULTIPLY_POLY] = &&L_OP_MULTIPLY_POLY,
+    [OP_GREATER_POLY] = &&L_OP_GREATER_POLY,
+    [OP_LESS_POLY] = &&L_OP_LESS_POLY,
 };
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include "ico_common.h"
 #include "ico_vm.h"
+#include "ico_heapdump.h"
 
 #define RUN_CODE(code) vm_interpret(code)
 
@@ -162,18 +163,138 @@ static void run_script(char* path) {
 //         MAIN RUNTIME
 //------------------------------
 
+// Print the command-line usage and exit
+static void exit_with_usage(const char* program) {
+    fprintf(stderr, "Usage:\n- Run script: %s [options] path\n- REPL: %s [options]\n"
+                    "Options:\n"
+                    "  -r        use register instructions for local variables\n"
+                    "  -d depth  maximum call depth (default %d)\n"
+                    "  -i us     incremental GC with a pause target in microseconds\n"
+                    "  -t kib    heap size of the first full collection (default %d, env ICO_GC_THRESHOLD)\n"
+                    "  -g factor heap growth between full collections (default %g, env ICO_GC_GROWTH)\n"
+                    "  -m kib    minimum allocation between full collections (env ICO_GC_MIN_INTERVAL)\n"
+                    "  -M mib    maximum heap size (env ICO_GC_MAX_HEAP)\n",
+            program, program, DEFAULT_MAX_FRAMES,
+            DEFAULT_GC_THRESHOLD / 1024, DEFAULT_GC_GROW_FACTOR);
+#ifdef USE_PARALLEL_MARK
+    fprintf(stderr, "  -j n      mark the heap with n threads in full collections\n"
+                    "  -J mib    heap size in MiB from which the marking is parallel (default %d)\n",
+            DEFAULT_PARALLEL_MARK_HEAP / (1024 * 1024));
+#endif
+    exit(64);
+}
+
+// The GC sizing options, which can be set with a command-line
+// option or an environment variable
+static const struct {
+    const char* option;
+    const char* env_var;
+} gc_size_options[] = {
+    {"-t", "ICO_GC_THRESHOLD"},
+    {"-g", "ICO_GC_GROWTH"},
+    {"-m", "ICO_GC_MIN_INTERVAL"},
+    {"-M", "ICO_GC_MAX_HEAP"},
+};
+
+// Set the GC sizing option at index idx of gc_size_options.
+// Return false if the value is invalid.
+static bool set_gc_size_option(GCOptions* gc_options, int idx, const char* value) {
+    char* end;
+    double number = strtod(value, &end);
+    if (end == value || *end != '\0' || number < 0) return false;
+
+    switch (idx) {
+        case 0: gc_options->initial_threshold = (size_t)(number * 1024); break;
+        case 1:
+            if (number < 1) return false;
+            gc_options->grow_factor = number;
+            break;
+        case 2: gc_options->min_interval = (size_t)(number * 1024); break;
+        case 3:
+            if (number < 1) return false;
+            gc_options->max_heap = (size_t)(number * 1024 * 1024);
+            break;
+    }
+    return true;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc == 1) { // REPL mode
-        init_vm(true);
+    // Parse the options before the script path
+    bool use_registers = false;
+    int max_frames = DEFAULT_MAX_FRAMES;
+    GCOptions gc_options = {
+        .pause_target = 0,
+        .mark_threads = 1,
+        .parallel_mark_heap = DEFAULT_PARALLEL_MARK_HEAP,
+        .initial_threshold = DEFAULT_GC_THRESHOLD,
+        .grow_factor = DEFAULT_GC_GROW_FACTOR,
+        .min_interval = 0,
+        .max_heap = SIZE_MAX,
+    };
+
+    // The environment variables are overridden by the command-line options
+    const int gc_size_option_count = sizeof(gc_size_options) / sizeof(gc_size_options[0]);
+    for (int i = 0; i < gc_size_option_count; i++) {
+        const char* value = getenv(gc_size_options[i].env_var);
+        if (value != NULL && !set_gc_size_option(&gc_options, i, value)) {
+            fprintf(stderr, "Invalid value \"%s\" for %s.\n", value, gc_size_options[i].env_var);
+            exit(64);
+        }
+    }
+
+    int arg_idx = 1;
+    for (; arg_idx < argc && argv[arg_idx][0] == '-'; arg_idx++) {
+        int gc_size_idx = 0;
+        while (gc_size_idx < gc_size_option_count
+                && strcmp(argv[arg_idx], gc_size_options[gc_size_idx].option) != 0) {
+            gc_size_idx++;
+        }
+
+        if (gc_size_idx < gc_size_option_count && arg_idx + 1 < argc) {
+            if (!set_gc_size_option(&gc_options, gc_size_idx, argv[++arg_idx])) {
+                exit_with_usage(argv[0]);
+            }
+        }
+        else if (strcmp(argv[arg_idx], "-r") == 0) {
+            use_registers = true;
+        }
+        else if (strcmp(argv[arg_idx], "-d") == 0 && arg_idx + 1 < argc) {
+            max_frames = atoi(argv[++arg_idx]);
+            if (max_frames < 1) exit_with_usage(argv[0]);
+        }
+        else if (strcmp(argv[arg_idx], "-i") == 0 && arg_idx + 1 < argc) {
+            int pause_target = atoi(argv[++arg_idx]);
+            if (pause_target < 1) exit_with_usage(argv[0]);
+            gc_options.pause_target = pause_target;
+        }
+#ifdef USE_PARALLEL_MARK
+        else if (strcmp(argv[arg_idx], "-j") == 0 && arg_idx + 1 < argc) {
+            gc_options.mark_threads = atoi(argv[++arg_idx]);
+            if (gc_options.mark_threads < 1) exit_with_usage(argv[0]);
+        }
+        else if (strcmp(argv[arg_idx], "-J") == 0 && arg_idx + 1 < argc) {
+            int heap_mib = atoi(argv[++arg_idx]);
+            if (heap_mib < 0) exit_with_usage(argv[0]);
+            gc_options.parallel_mark_heap = (size_t)heap_mib * 1024 * 1024;
+        }
+#endif
+        else {
+            exit_with_usage(argv[0]);
+        }
+    }
+
+    install_heap_dump_signal();
+
+    if (arg_idx == argc) { // REPL mode
+        init_vm(true, use_registers, max_frames, gc_options);
         run_repl();
     }
-    else if (argc == 2) { // Script mode
-        init_vm(false);
-        run_script(argv[1]);
+    else if (arg_idx == argc - 1) { // Script mode
+        init_vm(false, use_registers, max_frames, gc_options);
+        run_script(argv[arg_idx]);
     }
     else {
-        fprintf(stderr, "Usage:\n- Run script: %s path\n- REPL: %s\n", argv[0], argv[0]);
-        exit(64);
+        exit_with_usage(argv[0]);
     }
 
     free_vm();
@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+"""Analyze an Ico heap dump (see notes/heap_dump.md).
+
+Print the size per object type, the objects that retain the most memory
+according to the dominator tree of the object graph, and the memory
+retained by each root.
+"""
+
+import argparse
+import json
+from collections import defaultdict
+
+
+def load_graph(path):
+    with open(path) as f:
+        dump = json.load(f)
+    if dump.get("format") != "ico-heap":
+        raise SystemExit(f"{path}: not an Ico heap dump")
+
+    # Node 0 is a virtual root that refers to all roots
+    objects = dump["objects"]
+    index = {obj["id"]: i + 1 for i, obj in enumerate(objects)}
+    edges = [[] for _ in range(len(objects) + 1)]
+    root_names = defaultdict(list)
+    for root in dump["roots"]:
+        node = index[root["id"]]
+        edges[0].append(node)
+        root_names[node].append(f'{root["kind"]} {root["name"]}'.strip())
+    for i, obj in enumerate(objects):
+        edges[i + 1] = [index[e] for e in obj["edges"]]
+    return objects, edges, root_names
+
+
+def postorder(edges):
+    """Return the nodes reachable from node 0 in depth-first postorder."""
+    order = []
+    seen = [False] * len(edges)
+    seen[0] = True
+    stack = [(0, iter(edges[0]))]
+    while stack:
+        node, children = stack[-1]
+        for child in children:
+            if not seen[child]:
+                seen[child] = True
+                stack.append((child, iter(edges[child])))
+                break
+        else:
+            stack.pop()
+            order.append(node)
+    return order
+
+
+def dominators(edges):
+    """Immediate dominators, with the algorithm of Cooper, Harvey and Kennedy."""
+    order = postorder(edges)
+    number = {node: i for i, node in enumerate(order)}
+    preds = defaultdict(list)
+    for node in order:
+        for child in edges[node]:
+            preds[child].append(node)
+
+    def intersect(a, b):
+        while a != b:
+            while number[a] < number[b]:
+                a = idom[a]
+            while number[b] < number[a]:
+                b = idom[b]
+        return a
+
+    idom = {0: 0}
+    changed = True
+    while changed:
+        changed = False
+        for node in reversed(order[:-1]):  # Reverse postorder, without node 0
+            new_idom = None
+            for pred in preds[node]:
+                if pred in idom:
+                    new_idom = pred if new_idom is None else intersect(pred, new_idom)
+            if idom.get(node) != new_idom:
+                idom[node] = new_idom
+                changed = True
+    return order, idom
+
+
+def describe(obj):
+    name = obj.get("name")
+    if name is not None:
+        return f'{obj["type"]} {name}()'
+    if obj["type"] == "string":
+        return f'string of length {obj["length"]}'
+    return f'{obj["type"]} with {len(obj["edges"])} references'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", help="heap dump written by dumpHeap() or SIGUSR1")
+    parser.add_argument("--top", type=int, default=10, help="number of objects to list")
+    args = parser.parse_args()
+
+    objects, edges, root_names = load_graph(args.dump)
+    order, idom = dominators(edges)
+
+    # Retained size: the shallow sizes of the dominator subtree
+    retained = [0] + [obj["size"] for obj in objects]
+    for node in order[:-1]:  # Children come before their dominator in postorder
+        retained[idom[node]] += retained[node]
+
+    def root_of(node):
+        while idom[node] != 0:
+            node = idom[node]
+        names = root_names.get(node)
+        return ", ".join(names) if names else "several roots"
+
+    print(f"{len(objects)} objects, {retained[0]} bytes\n")
+
+    print(f'{"Type":<10}{"Count":>10}{"Bytes":>14}')
+    by_type = defaultdict(lambda: [0, 0])
+    for obj in objects:
+        by_type[obj["type"]][0] += 1
+        by_type[obj["type"]][1] += obj["size"]
+    for type_name, (count, size) in sorted(by_type.items(), key=lambda t: -t[1][1]):
+        print(f"{type_name:<10}{count:>10}{size:>14}")
+
+    print(f'\n{"Retained":>12}{"Shallow":>10}  Object (kept alive by)')
+    top = sorted(range(1, len(objects) + 1), key=lambda n: -retained[n])[:args.top]
+    for node in top:
+        obj = objects[node - 1]
+        print(f'{retained[node]:>12}{obj["size"]:>10}  {describe(obj)} ({root_of(node)})')
+
+    print(f'\n{"Retained":>12}  Root')
+    by_root = defaultdict(int)
+    for node in range(1, len(objects) + 1):
+        if idom.get(node) == 0:
+            by_root[root_of(node)] += retained[node]
+    for name, size in sorted(by_root.items(), key=lambda r: -r[1])[:args.top]:
+        print(f"{size:>12}  {name}")
+
+
+if __name__ == "__main__":
+    main()